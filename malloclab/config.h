@@ -57,14 +57,63 @@
 #define UTIL_WEIGHT .60
 
 /* 
- * Alignment requirement in bytes (either 4 or 8) 
+ * Alignment requirement in bytes (8 or 16). The 64-bit build uses 16 to
+ * match the x86-64 ABI; override with -DALIGNMENT=<n> if needed.
  */
-#define ALIGNMENT 8  
+#ifndef ALIGNMENT
+#ifdef __LP64__
+#define ALIGNMENT 16
+#else
+#define ALIGNMENT 8
+#endif
+#endif
 
 /* 
- * Maximum heap size in bytes 
+ * Maximum heap segment size in bytes (the threaded build raises it with
+ * -DMAX_HEAP, and it is also the largest heap of the threaded build)
  */
+#ifndef MAX_HEAP
 #define MAX_HEAP (20*(1<<20))  /* 20 MB */
+#endif
+
+/*
+ * Address space reserved for all heap segments together; the driver's
+ * -M flag overrides it. The 64-bit mm.c links blocks with 32-bit offsets
+ * in ALIGNMENT units, so it must stay below 4G*ALIGNMENT bytes.
+ */
+#ifndef MEM_RESERVE
+#ifdef __LP64__
+#define MEM_RESERVE ((size_t)16 << 30)  /* 16 GB */
+#else
+#define MEM_RESERVE ((size_t)1 << 30)   /* 1 GB */
+#endif
+#endif
+
+/*
+ * mm_free gives the top of the heap back with a negative mem_sbrk once
+ * the free block there is larger than TRIM_THRESHOLD bytes, keeping
+ * TRIM_THRESHOLD/2 of it so a malloc/free cycle at the top does not
+ * grow and shrink the heap every time.
+ */
+#ifndef TRIM_THRESHOLD
+#define TRIM_THRESHOLD (1 << 17)  /* 128 KB */
+#endif
+
+/*
+ * Requests of MMAP_THRESHOLD bytes or more get their own mem_map region,
+ * which mm_free unmaps at once and mm_realloc resizes with mremap.
+ */
+#ifndef MMAP_THRESHOLD
+#define MMAP_THRESHOLD (1 << 20)  /* 1 MB */
+#endif
+
+/*
+ * Free blocks of DECOMMIT_THRESHOLD bytes or more give the whole pages
+ * inside them back with MADV_DONTNEED (mem_decommit).
+ */
+#ifndef DECOMMIT_THRESHOLD
+#define DECOMMIT_THRESHOLD (1 << 20)  /* 1 MB */
+#endif
 
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
@@ -15,6 +15,12 @@
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#include <sys/resource.h>
+#ifdef MM_THREADS
+#include <pthread.h>
+#include <sched.h>
+#include <sys/time.h>
+#endif
 
 #include "mm.h"
 #include "memlib.h"
@@ -29,9 +35,18 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define BATCH_MAX     64 /* most requests replayed in one batch call (-b) */
+#define LAT_REPS       5 /* replays of each trace in the latency mode (-L) */
+
+/* The -T and -X options only exist in the threaded build */
+#ifdef MM_THREADS
+#define THREAD_OPTS "T:X:"
+#else
+#define THREAD_OPTS ""
+#endif
 
 /* Returns true if p is ALIGNMENT-byte aligned */
-#define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
+#define IS_ALIGNED(p)  ((((size_t)(p)) % ALIGNMENT) == 0)
 
 /****************************** 
  * The key compound data types 
@@ -46,9 +61,10 @@ typedef struct range_t {
 
 /* Characterizes a single trace operation (allocator request) */
 typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
+    enum {ALLOC, FREE, REALLOC, ALIGNED, CALLOC} type; /* type of request */
     int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc/realloc request */
+    int size;                         /* byte size of alloc/realloc request, or of the block to free */
+    int align;                        /* alignment of an aligned alloc request */
 } traceop_t;
 
 /* Holds the information for one trace file*/
@@ -78,18 +94,53 @@ typedef struct {
     double ops;      /* number of ops (malloc/free/realloc) in the trace */
     int valid;       /* was the trace processed correctly by the allocator? */
     double secs;     /* number of secs needed to run the trace */
+    double faults;   /* page faults taken while timing the trace */
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    double peak;     /* largest heap and mapped bytes during the util run (0 for libc) */
+    double final;    /* heap and mapped bytes at the end of the util run (0 for libc) */
+    double resident; /* bytes of those that are resident in memory (0 for libc) */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
 
+#ifdef MM_THREADS
+/* Holds the params and the result of one thread replaying a trace (-T) */
+typedef struct {
+    trace_t *trace;
+    int id;          /* thread number, also tags the payloads it writes */
+    int errors;      /* number of payloads found overwritten */
+} replay_t;
+
+/* 
+ * One thread of the cross-thread free stress test (-X). Thread i hands
+ * every block it allocates to thread i+1 (mod n) through a ring, and 
+ * frees the blocks that come in on its own ring.
+ */
+#define XRING    1024    /* ring slots, a power of 2 */
+#define XBATCH   16      /* blocks allocated before handing them on */
+#define XBLOCKS  200000  /* blocks allocated by each thread */
+typedef struct xthread_t {
+    int id;
+    int from;                 /* thread that allocated the blocks we free */
+    char *ring[XRING];        /* blocks handed to this thread... */
+    unsigned head, tail;      /* ...taken at head, put at tail */
+    struct xthread_t *next;   /* thread that frees our blocks */
+    int errors;               /* number of payloads found overwritten */
+} xthread_t;
+#endif
+
 /********************
  * Global variables
  *******************/
 int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
+static int sized_free = 0; /* free with mm_free_sized and the size from the trace (-z) */
+static int batched = 0;    /* replay runs of requests with the batch calls (-b) */
+static char *life_short = NULL; /* per request, whether the block it allocates is short-lived (-Y) */
+static int life_right, life_wrong; /* predictions mm_lifetime got right and wrong (-Y) */
+static int life_count;     /* graded malloc requests whose block is short-lived (-Y) */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
 /* Directory where default tracefiles are found */
@@ -100,6 +151,11 @@ static char *default_tracefiles[] = {
     DEFAULT_TRACEFILES, NULL
 };
 
+/* The fit policies of mm.c (MM_FIT) that -S runs every trace with */
+static char *fit_policies[] = {
+    "first", "next", "best", "good:1:50", "good:4:25", "good:16:10", NULL
+};
+
 
 /********************* 
  * Function prototypes 
@@ -125,9 +181,35 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
 static void eval_mm_speed(void *ptr);
 
+/* Routines for replaying runs of requests with the batch calls (-b) */
+static void batch_reset(void);
+static void *batch_malloc(trace_t *trace, int opnum);
+static void batch_free(trace_t *trace, int opnum);
+
+/* Routines for timing each request of a trace on its own (-L) */
+static double eval_mm_latency(trace_t *trace, double *avg, double *p99, int *worst);
+static double now_ns(void);
+static int cmp_double(const void *a, const void *b);
+
+/* Routine for running a trace under each fit policy (-S) */
+static void eval_mm_sweep(trace_t *trace, int tracenum, range_t **ranges);
+
+/* Routines for grading the lifetime predictor of mm.c (-Y) */
+static void life_reset(trace_t *trace);
+static void life_grade(trace_t *trace, int opnum);
+
+#ifdef MM_THREADS
+/* Routines for running a trace in several threads at once (-T) */
+static double eval_mm_threads(trace_t *trace, int tracenum, int nthreads);
+static void *replay_trace(void *ptr);
+static void eval_mm_remote(int maxthreads);
+static void *remote_worker(void *ptr);
+#endif
+
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
 static void usage(void);
+static long page_faults(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
 static void app_error(char *msg);
@@ -149,6 +231,16 @@ int main(int argc, char **argv)
 
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+#ifdef MM_THREADS
+    int nthreads = 0;    /* If set, replay each trace in this many threads (-T) */
+    int xthreads = 0;    /* If set, run the cross-thread free test up to this many threads (-X) */
+#endif
+    int latency = 0;     /* If set, time each request on its own (-L) */
+    int sweep = 0;       /* If set, run each trace under every fit policy (-S) */
+    int lifetimes = 0;   /* If set, grade the lifetime predictor on each trace (-Y) */
+    int mem_opts = 0;    /* memlib options for the heap (-P, -H) */
+    long reserve_mb = 0; /* If set, address space in MB for the heap segments (-M) */
+    long faults;         /* page fault count before a timed run */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -157,7 +249,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:hvVgalzbLSYPHF:M:" THREAD_OPTS)) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -186,6 +278,53 @@ int main(int argc, char **argv)
         case 'V': /* Be more verbose than -v */
             verbose = 2;
             break;
+        case 'z': /* Free with mm_free_sized */
+            sized_free = 1;
+            break;
+        case 'b': /* Replay runs of requests in batches */
+            batched = 1;
+            break;
+        case 'L': /* Report the slowest single request of each trace */
+            latency = 1;
+            break;
+        case 'S': /* Compare the fit policies on each trace */
+            sweep = 1;
+            break;
+        case 'Y': /* Grade the lifetime predictor */
+            lifetimes = 1;
+            break;
+        case 'F': /* Fit policy of mm.c, passed on in MM_FIT */
+            setenv("MM_FIT", optarg, 1);
+            break;
+        case 'P': /* Prefault the heap as it is committed */
+            mem_opts |= MEM_POPULATE;
+            break;
+        case 'H': /* Back the heap with transparent huge pages */
+            mem_opts |= MEM_HUGEPAGE;
+            break;
+        case 'M': /* Address space for all heap segments, in MB */
+            reserve_mb = atol(optarg);
+            if (reserve_mb < 1) {
+                usage();
+                exit(1);
+            }
+            break;
+#ifdef MM_THREADS
+        case 'T': /* Replay every trace in n threads at once */
+            nthreads = atoi(optarg);
+            if (nthreads < 1) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'X': /* Cross-thread free stress test with 1 to n threads */
+            xthreads = atoi(optarg);
+            if (xthreads < 1) {
+                usage();
+                exit(1);
+            }
+            break;
+#endif
         case 'h': /* Print this message */
 	    usage();
             exit(0);
@@ -231,7 +370,9 @@ int main(int argc, char **argv)
 		speed_params.trace = trace;
 		if (verbose > 1)
 		    printf("and performance.\n");
+		faults = page_faults();
 		libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
+		libc_stats[i].faults = page_faults() - faults;
 	    }
 	    free_trace(trace);
 	}
@@ -255,8 +396,140 @@ int main(int argc, char **argv)
 	unix_error("mm_stats calloc in main failed");
     
     /* Initialize the simulated memory system in memlib.c */
+    mem_options(mem_opts);
+    if (reserve_mb > 0)
+	mem_reserve((size_t)reserve_mb << 20);
     mem_init(); 
 
+#ifdef MM_THREADS
+    if (xthreads > 0) {
+	eval_mm_remote(xthreads);
+	if (errors > 0)
+	    printf("Terminated with %d errors\n", errors);
+	exit(0);
+    }
+
+    /* 
+     * In the -T mode each trace is only replayed by several threads at
+     * once, and the aggregate throughput is reported.
+     */
+    if (nthreads > 0) {
+	secs = 0;
+	ops = 0;
+	printf("trace  threads       ops      secs  Kops\n");
+	for (i=0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    mm_stats[i].secs = eval_mm_threads(trace, i, nthreads);
+	    mm_stats[i].ops = (double)trace->num_ops * nthreads;
+	    printf("%2d     %7d  %8.0f  %8.6f %5.0f\n", i, nthreads,
+		   mm_stats[i].ops, mm_stats[i].secs,
+		   mm_stats[i].ops / 1e3 / mm_stats[i].secs);
+	    secs += mm_stats[i].secs;
+	    ops += mm_stats[i].ops;
+	    free_trace(trace);
+	}
+	printf("Total  %7d  %8.0f  %8.6f %5.0f\n", nthreads, ops, secs, 
+	       ops / 1e3 / secs);
+	if (errors > 0)
+	    printf("Terminated with %d errors\n", errors);
+	exit(0);
+    }
+#endif
+
+    /*
+     * In the -L mode each trace is checked and then replayed with every
+     * request timed on its own, and the slowest request is reported.
+     */
+    if (latency) {
+	double avg = 0, p99 = 0, max, worst_max = 0;
+	int worst = 0;
+
+	printf("trace       ops    avg ns    p99 ns    max ns  slowest\n");
+	for (i=0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    if (!eval_mm_valid(trace, i, &ranges)) {
+		printf("%2d  %8d  not valid\n", i, trace->num_ops);
+		free_trace(trace);
+		continue;
+	    }
+	    max = eval_mm_latency(trace, &avg, &p99, &worst);
+	    printf("%2d  %8d  %8.0f  %8.0f  %8.0f  %c %d (line %d)\n", i,
+		   trace->num_ops, avg, p99, max,
+		   "afrmc"[trace->ops[worst].type], trace->ops[worst].size,
+		   LINENUM(worst));
+	    if (max > worst_max)
+		worst_max = max;
+	    free_trace(trace);
+	}
+	printf("Max                                  %8.0f\n", worst_max);
+	if (errors > 0)
+	    printf("Terminated with %d errors\n", errors);
+	exit(0);
+    }
+
+    /*
+     * In the -S mode each trace is run under every fit policy, and the
+     * policies that no other one beats on both util and throughput are
+     * marked as the Pareto frontier of that trace.
+     */
+    if (sweep) {
+	printf("trace  policy       util      Kops\n");
+	for (i=0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    eval_mm_sweep(trace, i, &ranges);
+	    free_trace(trace);
+	}
+	if (errors > 0)
+	    printf("Terminated with %d errors\n", errors);
+	exit(0);
+    }
+
+    /*
+     * In the -Y mode each trace is run without and then with the lifetime
+     * predictor (MM_LIFETIME). The second run also asks mm_lifetime about
+     * every malloc request and grades it against the lifetime the block
+     * actually has in the trace, counted in allocations. Requests made
+     * before the predictor starts are not graded.
+     */
+    if (lifetimes) {
+	double util_off, util_on;
+
+	printf("trace  graded  short  accuracy  util off  util on\n");
+	for (i=0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    unsetenv("MM_LIFETIME");
+	    if (!eval_mm_valid(trace, i, &ranges)) {
+		printf("%2d     not valid\n", i);
+		free_trace(trace);
+		continue;
+	    }
+	    util_off = eval_mm_util(trace, i, &ranges);
+	    setenv("MM_LIFETIME", "1", 1);
+	    if (!eval_mm_valid(trace, i, &ranges)) {
+		printf("%2d     not valid with the predictor\n", i);
+		free_trace(trace);
+		continue;
+	    }
+	    life_reset(trace);
+	    util_on = eval_mm_util(trace, i, &ranges);
+	    if (life_right + life_wrong == 0)
+		printf("%2d     %6d    n/a       n/a      %3.0f%%     %3.0f%%\n",
+		       i, 0, util_off * 100.0, util_on * 100.0);
+	    else
+		printf("%2d     %6d  %4.0f%%     %4.0f%%      %3.0f%%     %3.0f%%\n",
+		       i, life_right + life_wrong,
+		       100.0 * life_count / (life_right + life_wrong),
+		       100.0 * life_right / (life_right + life_wrong),
+		       util_off * 100.0, util_on * 100.0);
+	    free(life_short);
+	    life_short = NULL;
+	    free_trace(trace);
+	}
+	if (errors > 0)
+	    printf("Terminated with %d errors\n", errors);
+	exit(0);
+    }
+
     /* Evaluate student's mm malloc package using the K-best scheme */
     for (i=0; i < num_tracefiles; i++) {
 	trace = read_trace(tracedir, tracefiles[i]);
@@ -268,11 +541,16 @@ int main(int argc, char **argv)
 	    if (verbose > 1)
 		printf("efficiency, ");
 	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
+	    mm_stats[i].peak = mem_peak_heapsize();
+	    mm_stats[i].final = mem_heapsize() + mem_mapsize();
+	    mm_stats[i].resident = (double)mem_resident() * mem_pagesize();
 	    speed_params.trace = trace;
 	    speed_params.ranges = ranges;
 	    if (verbose > 1)
 		printf("and performance.\n");
+	    faults = page_faults();
 	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+	    mm_stats[i].faults = page_faults() - faults;
 	}
 	free_trace(trace);
     }
@@ -367,9 +645,10 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap, or in a mapping */
+    if (((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
+	 (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+	!mem_in_map(lo, hi)) {
 	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
 		lo, hi, mem_heap_lo(), mem_heap_hi());
 	malloc_error(tracenum, opnum, msg);
@@ -449,7 +728,7 @@ static trace_t *read_trace(char *tracedir, char *filename)
     trace_t *trace;
     char type[MAXLINE];
     char path[MAXLINE];
-    unsigned index, size;
+    unsigned index, size, align;
     unsigned max_index = 0;
     unsigned op_index;
 
@@ -497,6 +776,7 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	    trace->ops[op_index].type = ALLOC;
 	    trace->ops[op_index].index = index;
 	    trace->ops[op_index].size = size;
+	    trace->block_sizes[index] = size;
 	    max_index = (index > max_index) ? index : max_index;
 	    break;
 	case 'r':
@@ -504,12 +784,31 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	    trace->ops[op_index].type = REALLOC;
 	    trace->ops[op_index].index = index;
 	    trace->ops[op_index].size = size;
+	    trace->block_sizes[index] = size;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
+	case 'm':
+	    fscanf(tracefile, "%u %u %u", &index, &size, &align);
+	    trace->ops[op_index].type = ALIGNED;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = size;
+	    trace->block_sizes[index] = size;
+	    trace->ops[op_index].align = align;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
+	case 'c':
+	    fscanf(tracefile, "%u %u", &index, &size);
+	    trace->ops[op_index].type = CALLOC;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = size;
+	    trace->block_sizes[index] = size;
 	    max_index = (index > max_index) ? index : max_index;
 	    break;
 	case 'f':
 	    fscanf(tracefile, "%ud", &index);
 	    trace->ops[op_index].type = FREE;
 	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = trace->block_sizes[index]; /* for mm_free_sized */
 	    break;
 	default:
 	    printf("Bogus type character (%c) in tracefile %s\n", 
@@ -552,12 +851,14 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     int index;
     int size;
     int oldsize;
+    size_t usable;
     char *newp;
     char *oldp;
     char *p;
     
     /* Reset the heap and free any records in the range list */
     mem_reset_brk();
+    batch_reset();
     clear_ranges(ranges);
 
     /* Call the mm package's init function */
@@ -573,10 +874,34 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 
         switch (trace->ops[i].type) {
 
+        case ALIGNED: /* mm_memalign */
+        case CALLOC: /* mm_calloc */
         case ALLOC: /* mm_malloc */
 
 	    /* Call the student's malloc */
-	    if ((p = mm_malloc(size)) == NULL) {
+	    if (trace->ops[i].type == CALLOC) {
+		if ((p = mm_calloc(1, size)) == NULL) {
+		    malloc_error(tracenum, i, "mm_calloc failed.");
+		    return 0;
+		}
+		for (j = 0; j < size; j++) {
+		    if (p[j] != 0) {
+			malloc_error(tracenum, i, "mm_calloc did not zero the block");
+			return 0;
+		    }
+		}
+	    }
+	    else if (trace->ops[i].type == ALIGNED) {
+		if ((p = mm_memalign(trace->ops[i].align, size)) == NULL) {
+		    malloc_error(tracenum, i, "mm_memalign failed.");
+		    return 0;
+		}
+		if ((size_t)p % trace->ops[i].align) {
+		    malloc_error(tracenum, i, "mm_memalign payload is not aligned");
+		    return 0;
+		}
+	    }
+	    else if ((p = batched ? batch_malloc(trace, i) : mm_malloc(size)) == NULL) {
 		malloc_error(tracenum, i, "mm_malloc failed.");
 		return 0;
 	    }
@@ -584,9 +909,14 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    /* 
 	     * Test the range of the new block for correctness and add it 
 	     * to the range list if OK. The block must be  be aligned properly,
-	     * and must not overlap any currently allocated block. 
+	     * and must not overlap any currently allocated block. The whole
+	     * usable size belongs to the caller, so it is the range checked.
 	     */ 
-	    if (add_range(ranges, p, size, tracenum, i) == 0)
+	    if ((usable = mm_usable_size(p)) < (size_t)size) {
+		malloc_error(tracenum, i, "mm_usable_size is less than the request");
+		return 0;
+	    }
+	    if (add_range(ranges, p, (int)usable, tracenum, i) == 0)
 		return 0;
 	    
 	    /* ADDED: cgw
@@ -614,7 +944,11 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    remove_range(ranges, oldp);
 	    
 	    /* Check new block for correctness and add it to range list */
-	    if (add_range(ranges, newp, size, tracenum, i) == 0)
+	    if ((usable = mm_usable_size(newp)) < (size_t)size) {
+		malloc_error(tracenum, i, "mm_usable_size is less than the request");
+		return 0;
+	    }
+	    if (add_range(ranges, newp, (int)usable, tracenum, i) == 0)
 		return 0;
 	    
 	    /* ADDED: cgw
@@ -625,7 +959,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
 	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
+	      if ((unsigned char)newp[j] != (index & 0xFF)) {
 		malloc_error(tracenum, i, "mm_realloc did not preserve the "
 			     "data from old block");
 		return 0;
@@ -643,7 +977,12 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    /* Remove region from list and call student's free function */
 	    p = trace->blocks[index];
 	    remove_range(ranges, p);
-	    mm_free(p);
+	    if (batched)
+		batch_free(trace, i);
+	    else if (sized_free)
+		mm_free_sized(p, size);
+	    else
+		mm_free(p);
 	    break;
 
 	default:
@@ -661,10 +1000,11 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   The idea is to remember the high water mark "hwm" of the heap for 
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the 
- *   size of the heap in bytes after running the student's malloc 
- *   package on the trace. Note that our implementation of mem_sbrk() 
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap. 
+ *   largest size of the heap (and of the regions the package got 
+ *   from mem_map) in bytes while running the student's malloc 
+ *   package on the trace. mem_sbrk() lets the package give 
+ *   memory back by decrementing the brk pointer, so the final heap 
+ *   size can be smaller than this peak. 
  *   
  */
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
@@ -679,17 +1019,29 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 
     /* initialize the heap and the mm malloc package */
     mem_reset_brk();
+    batch_reset();
     if (mm_init() < 0)
 	app_error("mm_init failed in eval_mm_util");
 
     for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
 
+        case ALIGNED: /* mm_memalign */
+        case CALLOC: /* mm_calloc */
         case ALLOC: /* mm_alloc */
 	    index = trace->ops[i].index;
 	    size = trace->ops[i].size;
 
-	    if ((p = mm_malloc(size)) == NULL) 
+	    if (trace->ops[i].type == ALIGNED)
+		p = mm_memalign(trace->ops[i].align, size);
+	    else if (trace->ops[i].type == CALLOC)
+		p = mm_calloc(1, size);
+	    else {
+		if (life_short != NULL)
+		    life_grade(trace, i);
+		p = batched ? batch_malloc(trace, i) : mm_malloc(size);
+	    }
+	    if (p == NULL) 
 		app_error("mm_malloc failed in eval_mm_util");
 	    
 	    /* Remember region and size */
@@ -732,7 +1084,12 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    size = trace->block_sizes[index];
 	    p = trace->blocks[index];
 	    
-	    mm_free(p);
+	    if (batched)
+		batch_free(trace, i);
+	    else if (sized_free)
+		mm_free_sized(p, size);
+	    else
+		mm_free(p);
 	    
 	    /* Keep track of current total size
 	     * of all allocated blocks */
@@ -746,7 +1103,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
         }
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    return ((double)max_total_size / (double)mem_peak_heapsize());
 }
 
 
@@ -762,6 +1119,7 @@ static void eval_mm_speed(void *ptr)
 
     /* Reset the heap and initialize the mm package */
     mem_reset_brk();
+    batch_reset();
     if (mm_init() < 0) 
 	app_error("mm_init failed in eval_mm_speed");
 
@@ -772,11 +1130,27 @@ static void eval_mm_speed(void *ptr)
         case ALLOC: /* mm_malloc */
             index = trace->ops[i].index;
             size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
+            if ((p = batched ? batch_malloc(trace, i) : mm_malloc(size)) == NULL)
 		app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
             break;
 
+        case ALIGNED: /* mm_memalign */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            if ((p = mm_memalign(trace->ops[i].align, size)) == NULL)
+		app_error("mm_memalign error in eval_mm_speed");
+            trace->blocks[index] = p;
+            break;
+
+        case CALLOC: /* mm_calloc */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            if ((p = mm_calloc(1, size)) == NULL)
+		app_error("mm_calloc error in eval_mm_speed");
+            trace->blocks[index] = p;
+            break;
+
 	case REALLOC: /* mm_realloc */
 	    index = trace->ops[i].index;
             newsize = trace->ops[i].size;
@@ -789,7 +1163,12 @@ static void eval_mm_speed(void *ptr)
         case FREE: /* mm_free */
             index = trace->ops[i].index;
             block = trace->blocks[index];
-            mm_free(block);
+            if (batched)
+                batch_free(trace, i);
+            else if (sized_free)
+                mm_free_sized(block, trace->ops[i].size);
+            else
+                mm_free(block);
             break;
 
 	default:
@@ -797,6 +1176,504 @@ static void eval_mm_speed(void *ptr)
         }
 }
 
+/*
+ * Batched replay (-b). A run of consecutive allocs of one size is
+ * served by one mm_malloc_batch call and handed out a block per
+ * request; a run of consecutive frees goes to mm_free_batch at its
+ * first request, and the rest of the run then has nothing to do.
+ */
+static void *batch_blocks[BATCH_MAX]; /* blocks of the current alloc run */
+static int batch_next;                /* next of them to hand out */
+static int batch_count;               /* how many the batch call gave us */
+static int batch_freed;               /* first request past the last free run */
+
+/*
+ * batch_reset - Forget any run left over from the previous replay
+ */
+static void batch_reset(void)
+{
+    batch_next = batch_count = batch_freed = 0;
+}
+
+/*
+ * batch_malloc - Return the block for alloc request opnum, starting
+ *     a new batch at it if the current one is used up
+ */
+static void *batch_malloc(trace_t *trace, int opnum)
+{
+    int n;
+    int size = trace->ops[opnum].size;
+
+    if (batch_next < batch_count)
+	return batch_blocks[batch_next++];
+
+    for (n = 1; n < BATCH_MAX && opnum + n < trace->num_ops; n++)
+	if (trace->ops[opnum + n].type != ALLOC ||
+	    trace->ops[opnum + n].size != size)
+	    break;
+    if (n == 1)
+	return mm_malloc(size);
+
+    batch_next = 0;
+    if ((batch_count = mm_malloc_batch(size, n, batch_blocks)) == 0)
+	return NULL;
+    return batch_blocks[batch_next++];
+}
+
+/*
+ * batch_free - Free the run of frees that starts at request opnum
+ */
+static void batch_free(trace_t *trace, int opnum)
+{
+    int n;
+    void *ptrs[BATCH_MAX];
+
+    if (opnum < batch_freed)
+	return; /* already freed with the start of its run */
+
+    for (n = 0; n < BATCH_MAX && opnum + n < trace->num_ops; n++) {
+	if (trace->ops[opnum + n].type != FREE)
+	    break;
+	ptrs[n] = trace->blocks[trace->ops[opnum + n].index];
+    }
+    if (n == 1 && sized_free)
+	mm_free_sized(ptrs[0], trace->ops[opnum].size);
+    else
+	mm_free_batch(ptrs, n);
+    batch_freed = opnum + n;
+}
+
+/*
+ * now_ns - Monotonic time in nanoseconds
+ */
+static double now_ns(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec * 1e9 + (double)t.tv_nsec;
+}
+
+/*
+ * cmp_double - qsort order for the request latencies
+ */
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * eval_mm_sweep - Check and time the trace under each of fit_policies
+ *     and print one line per policy, with a * on the policies of the
+ *     util/throughput Pareto frontier.
+ */
+static void eval_mm_sweep(trace_t *trace, int tracenum, range_t **ranges)
+{
+    double util[sizeof(fit_policies) / sizeof(char *)];
+    double kops[sizeof(fit_policies) / sizeof(char *)];
+    int valid[sizeof(fit_policies) / sizeof(char *)];
+    speed_t speed_params;
+    int p, q, best;
+
+    for (p = 0; fit_policies[p] != NULL; p++) {
+	setenv("MM_FIT", fit_policies[p], 1);
+	valid[p] = eval_mm_valid(trace, tracenum, ranges);
+	if (!valid[p])
+	    continue;
+	util[p] = eval_mm_util(trace, tracenum, ranges);
+	speed_params.trace = trace;
+	speed_params.ranges = *ranges;
+	kops[p] = trace->num_ops / 1e3 / fsecs(eval_mm_speed, &speed_params);
+    }
+    for (p = 0; fit_policies[p] != NULL; p++) {
+	if (!valid[p]) {
+	    printf("%2d     %-10s  not valid\n", tracenum, fit_policies[p]);
+	    continue;
+	}
+	/* on the frontier unless another policy is as good on both and better on one */
+	best = 1;
+	for (q = 0; fit_policies[q] != NULL; q++)
+	    if (valid[q] && util[q] >= util[p] && kops[q] >= kops[p] &&
+		(util[q] > util[p] || kops[q] > kops[p]))
+		best = 0;
+	printf("%2d     %-10s  %3.0f%%  %8.0f  %s\n", tracenum, fit_policies[p],
+	       util[p] * 100.0, kops[p], best ? "*" : "");
+    }
+}
+
+/*
+ * life_reset - Work out which requests of the trace allocate a block that
+ *     is freed within MM_SHORT_LIVED allocations (or reallocations) of its
+ *     own, and clear the grades.
+ */
+static void life_reset(trace_t *trace)
+{
+    int *born_op, *born_tick;
+    int i, index, tick = 0;
+
+    life_short = (char *)calloc(trace->num_ops, sizeof(char));
+    born_op = (int *)malloc(trace->num_ids * sizeof(int));
+    born_tick = (int *)malloc(trace->num_ids * sizeof(int));
+    if ((life_short == NULL) || (born_op == NULL) || (born_tick == NULL))
+	unix_error("life_reset failed");
+    for (i = 0; i < trace->num_ops; i++) {
+	index = trace->ops[i].index;
+	if (trace->ops[i].type == FREE) {
+	    if (tick - born_tick[index] < MM_SHORT_LIVED)
+		life_short[born_op[index]] = 1;
+	    continue;
+	}
+	tick++;
+	if (trace->ops[i].type != REALLOC) {
+	    born_op[index] = i;
+	    born_tick[index] = tick;
+	}
+    }
+    free(born_op);
+    free(born_tick);
+    life_right = life_wrong = life_count = 0;
+}
+
+/*
+ * life_grade - Ask mm_lifetime about the malloc request opnum, just before
+ *     it is made, and grade the answer if there is one
+ */
+static void life_grade(trace_t *trace, int opnum)
+{
+    int predicted = mm_lifetime(trace->ops[opnum].size, 0);
+
+    if (predicted < 0)
+	return;
+    life_count += life_short[opnum];
+    if (predicted == life_short[opnum])
+	life_right++;
+    else
+	life_wrong++;
+}
+
+/*
+ * eval_mm_latency - Replay the trace LAT_REPS times, timing every
+ *     request on its own, less the cost of reading the clock. Returns
+ *     the smallest over the replays of the slowest request in ns, like
+ *     the K-best scheme keeps the fastest run. *avg, *p99 and *worst get
+ *     the mean, the 99th percentile and the slowest request of that replay.
+ */
+static double eval_mm_latency(trace_t *trace, double *avg, double *p99, int *worst)
+{
+    int i, rep, index, size, slowest = 0;
+    double start, t, ovhd, sum, max, best = DBL_MAX;
+    double *lat;
+    char *p;
+
+    if ((lat = (double *)malloc(trace->num_ops * sizeof(double))) == NULL)
+	unix_error("malloc failed in eval_mm_latency");
+
+    /* The clock is read twice per request; take that off each one */
+    ovhd = DBL_MAX;
+    for (i = 0; i < 1000; i++) {
+	start = now_ns();
+	if ((t = now_ns() - start) < ovhd)
+	    ovhd = t;
+    }
+
+    for (rep = 0; rep < LAT_REPS; rep++) {
+	mem_reset_brk();
+	if (mm_init() < 0)
+	    app_error("mm_init failed in eval_mm_latency");
+
+	max = 0;
+	sum = 0;
+	for (i = 0; i < trace->num_ops; i++) {
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    start = now_ns();
+	    switch (trace->ops[i].type) {
+	    case ALLOC: /* mm_malloc */
+		p = mm_malloc(size);
+		break;
+	    case ALIGNED: /* mm_memalign */
+		p = mm_memalign(trace->ops[i].align, size);
+		break;
+	    case CALLOC: /* mm_calloc */
+		p = mm_calloc(1, size);
+		break;
+	    case REALLOC: /* mm_realloc */
+		p = mm_realloc(trace->blocks[index], size);
+		break;
+	    case FREE: /* mm_free */
+		if (sized_free)
+		    mm_free_sized(trace->blocks[index], size);
+		else
+		    mm_free(trace->blocks[index]);
+		p = NULL;
+		break;
+	    default:
+		app_error("Nonexistent request type in eval_mm_latency");
+	    }
+	    t = now_ns() - start - ovhd;
+	    lat[i] = (t > 0) ? t : 0;
+	    if (trace->ops[i].type != FREE) {
+		if (p == NULL)
+		    app_error("mm_malloc failed in eval_mm_latency");
+		trace->blocks[index] = p;
+	    }
+	    sum += lat[i];
+	    if (lat[i] > max) {
+		max = lat[i];
+		slowest = i;
+	    }
+	}
+
+	if (max < best) {
+	    best = max;
+	    *avg = sum / trace->num_ops;
+	    *worst = slowest;
+	    qsort(lat, trace->num_ops, sizeof(double), cmp_double);
+	    *p99 = lat[(int)(0.99 * (trace->num_ops - 1))];
+	}
+    }
+    free(lat);
+    return best;
+}
+
+#ifdef MM_THREADS
+/*
+ * eval_mm_threads - Replay the trace in nthreads threads at once, each
+ *    with its own blocks, and return the elapsed wall clock time.
+ */
+static double eval_mm_threads(trace_t *trace, int tracenum, int nthreads)
+{
+    pthread_t *tids;
+    replay_t *args;
+    struct timeval start, end;
+    int i;
+
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (mm_init() < 0) 
+	app_error("mm_init failed in eval_mm_threads");
+
+    if ((tids = (pthread_t *)malloc(nthreads * sizeof(pthread_t))) == NULL ||
+	(args = (replay_t *)malloc(nthreads * sizeof(replay_t))) == NULL)
+	unix_error("malloc failed in eval_mm_threads");
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < nthreads; i++) {
+	args[i].trace = trace;
+	args[i].id = i;
+	args[i].errors = 0;
+	if (pthread_create(&tids[i], NULL, replay_trace, &args[i]) != 0)
+	    unix_error("pthread_create failed in eval_mm_threads");
+    }
+    for (i = 0; i < nthreads; i++)
+	pthread_join(tids[i], NULL);
+    gettimeofday(&end, NULL);
+
+    for (i = 0; i < nthreads; i++) {
+	if (args[i].errors > 0) {
+	    sprintf(msg, "thread %d found %d overwritten payloads", i, 
+		    args[i].errors);
+	    malloc_error(tracenum, 0, msg);
+	}
+    }
+    free(tids);
+    free(args);
+    return (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+}
+
+/*
+ * eval_mm_remote - Cross-thread free stress test. For 1 to maxthreads
+ *    threads, every block is freed by another thread than the one that
+ *    allocated it (except with a single thread), and the aggregate
+ *    throughput and the speedup over one thread are reported.
+ */
+static void eval_mm_remote(int maxthreads)
+{
+    pthread_t *tids;
+    xthread_t *xs;
+    struct timeval start, end;
+    double secs, ops, base = 0;
+    int i, n;
+
+    if ((tids = (pthread_t *)malloc(maxthreads * sizeof(pthread_t))) == NULL ||
+	(xs = (xthread_t *)malloc(maxthreads * sizeof(xthread_t))) == NULL)
+	unix_error("malloc failed in eval_mm_remote");
+
+    printf("Cross-thread free test, %d blocks per thread\n", XBLOCKS);
+    printf("threads       ops      secs  Kops  speedup\n");
+    for (n = 1; n <= maxthreads; n++) {
+	mem_reset_brk();
+	if (mm_init() < 0) 
+	    app_error("mm_init failed in eval_mm_remote");
+	for (i = 0; i < n; i++) {
+	    xs[i].id = i;
+	    xs[i].head = xs[i].tail = 0;
+	    xs[i].next = &xs[(i + 1) % n];
+	    xs[i].from = (i + n - 1) % n;
+	    xs[i].errors = 0;
+	}
+	gettimeofday(&start, NULL);
+	for (i = 0; i < n; i++)
+	    if (pthread_create(&tids[i], NULL, remote_worker, &xs[i]) != 0)
+		unix_error("pthread_create failed in eval_mm_remote");
+	for (i = 0; i < n; i++)
+	    pthread_join(tids[i], NULL);
+	gettimeofday(&end, NULL);
+
+	for (i = 0; i < n; i++) {
+	    if (xs[i].errors > 0) {
+		sprintf(msg, "%d threads: thread %d found %d overwritten payloads",
+			n, i, xs[i].errors);
+		malloc_error(0, 0, msg);
+	    }
+	}
+	secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+	ops = 2.0 * XBLOCKS * n; /* one malloc and one free per block */
+	if (n == 1)
+	    base = ops / secs;
+	printf("%7d  %8.0f  %8.6f %5.0f  %7.2f\n", n, ops, secs, 
+	       ops / 1e3 / secs, (ops / secs) / base);
+    }
+    free(tids);
+    free(xs);
+}
+
+/* remote_take - free whatever came in on our ring; returns how many */
+static int remote_take(xthread_t *x)
+{
+    unsigned head = x->head; /* only we move head */
+    unsigned tail = __atomic_load_n(&x->tail, __ATOMIC_ACQUIRE);
+    int n = 0;
+    char *p;
+
+    while (head != tail) {
+	p = x->ring[head % XRING];
+	if (p[0] != (char)x->from)
+	    x->errors++;
+	mm_free(p);
+	head++;
+	n++;
+    }
+    __atomic_store_n(&x->head, head, __ATOMIC_RELEASE);
+    return n;
+}
+
+/*
+ * remote_worker - Thread body for eval_mm_remote
+ */
+static void *remote_worker(void *ptr)
+{
+    xthread_t *x = (xthread_t *)ptr;
+    xthread_t *to = x->next;
+    char *batch[XBATCH];
+    unsigned seed = x->id + 1;
+    int done = 0, freed = 0, i, k, size;
+
+    while (done < XBLOCKS) {
+	for (i = 0; i < XBATCH; i++) {
+	    seed = seed * 1103515245 + 12345;
+	    size = 16 + (seed >> 16) % 497; /* 16 to 512 bytes */
+	    if ((batch[i] = mm_malloc(size)) == NULL)
+		app_error("mm_malloc error in remote_worker");
+	    batch[i][0] = (char)x->id;
+	}
+	for (i = 0; i < XBATCH; i++) {
+	    /* while the next ring is full, keep ours moving so nobody waits forever */
+	    while (to->tail - __atomic_load_n(&to->head, __ATOMIC_ACQUIRE) == XRING) {
+		if ((k = remote_take(x)) == 0)
+		    sched_yield();
+		freed += k;
+	    }
+	    to->ring[to->tail % XRING] = batch[i]; /* only we move to->tail */
+	    __atomic_store_n(&to->tail, to->tail + 1, __ATOMIC_RELEASE);
+	}
+	done += XBATCH;
+	freed += remote_take(x);
+    }
+    /* the previous thread hands us as many blocks as we allocated */
+    while (freed < XBLOCKS) {
+	if ((k = remote_take(x)) == 0)
+	    sched_yield();
+	freed += k;
+    }
+    return NULL;
+}
+
+/*
+ * replay_trace - Thread body for eval_mm_threads. The first and last 
+ *    payload bytes of each block carry a tag of the thread and block, 
+ *    and are checked before the block is reallocated or freed.
+ */
+static void *replay_trace(void *ptr)
+{
+    replay_t *arg = (replay_t *)ptr;
+    trace_t *trace = arg->trace;
+    char **blocks;
+    int *sizes;
+    int i, index, size, oldsize;
+    char tag;
+    char *p;
+
+    if ((blocks = (char **)calloc(trace->num_ids, sizeof(char *))) == NULL ||
+	(sizes = (int *)calloc(trace->num_ids, sizeof(int))) == NULL)
+	unix_error("calloc failed in replay_trace");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	tag = (char)(arg->id * 37 + index);
+	p = blocks[index];
+	oldsize = sizes[index];
+	if (trace->ops[i].type != ALLOC && trace->ops[i].type != ALIGNED &&
+	    trace->ops[i].type != CALLOC && p != NULL && oldsize > 0 &&
+	    (p[0] != tag || p[oldsize - 1] != tag))
+	    arg->errors++;
+
+        switch (trace->ops[i].type) {
+        case ALLOC: /* mm_malloc */
+	    if ((p = mm_malloc(size)) == NULL)
+		app_error("mm_malloc error in replay_trace");
+	    break;
+        case ALIGNED: /* mm_memalign */
+	    if ((p = mm_memalign(trace->ops[i].align, size)) == NULL ||
+		(size_t)p % trace->ops[i].align)
+		app_error("mm_memalign error in replay_trace");
+	    break;
+        case CALLOC: /* mm_calloc; both ends have to be zero */
+	    if ((p = mm_calloc(1, size)) == NULL)
+		app_error("mm_calloc error in replay_trace");
+	    if (p[0] != 0 || p[size - 1] != 0)
+		arg->errors++;
+	    break;
+	case REALLOC: /* mm_realloc; the first byte has to move along */
+	    if ((p = mm_realloc(p, size)) == NULL && size > 0)
+		app_error("mm_realloc error in replay_trace");
+	    if (p != NULL && oldsize > 0 && p[0] != tag)
+		arg->errors++;
+	    break;
+        case FREE: /* mm_free */
+	    if (sized_free)
+		mm_free_sized(p, oldsize);
+	    else
+		mm_free(p);
+	    p = NULL;
+	    size = 0;
+	    break;
+	default:
+	    app_error("Nonexistent request type in replay_trace");
+        }
+	if (p != NULL && size > 0)
+	    p[0] = p[size - 1] = tag;
+	blocks[index] = p;
+	sizes[index] = size;
+    }
+    free(blocks);
+    free(sizes);
+    return NULL;
+}
+#endif
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -819,6 +1696,23 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 	    trace->blocks[trace->ops[i].index] = p;
 	    break;
 
+        case ALIGNED: /* posix_memalign */
+	    if (posix_memalign((void **)&p, trace->ops[i].align,
+			       trace->ops[i].size) != 0) {
+		malloc_error(tracenum, i, "libc posix_memalign failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+        case CALLOC: /* calloc */
+	    if ((p = calloc(1, trace->ops[i].size)) == NULL) {
+		malloc_error(tracenum, i, "libc calloc failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
 	case REALLOC: /* realloc */
             newsize = trace->ops[i].size;
 	    oldp = trace->blocks[trace->ops[i].index];
@@ -863,6 +1757,22 @@ static void eval_libc_speed(void *ptr)
 	    trace->blocks[index] = p;
 	    break;
 
+        case ALIGNED: /* posix_memalign */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    if (posix_memalign((void **)&p, trace->ops[i].align, size) != 0)
+		unix_error("posix_memalign failed in eval_libc_speed");
+	    trace->blocks[index] = p;
+	    break;
+
+        case CALLOC: /* calloc */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    if ((p = calloc(1, size)) == NULL)
+		unix_error("calloc failed in eval_libc_speed");
+	    trace->blocks[index] = p;
+	    break;
+
 	case REALLOC: /* realloc */
 	    index = trace->ops[i].index;
 	    newsize = trace->ops[i].size;
@@ -898,17 +1808,23 @@ static void printresults(int n, stats_t *stats)
     double util = 0;
 
     /* Print the individual results for each trace */
-    printf("%5s%7s %5s%8s%10s%6s\n", 
-	   "trace", " valid", "util", "ops", "secs", "Kops");
+    printf("%5s%7s %5s%8s%10s%6s%9s%9s%7s%8s\n", 
+	   "trace", " valid", "util", "ops", "secs", "Kops", "peakKB", "finalKB", "rssKB", "faults");
     for (i=0; i < n; i++) {
 	if (stats[i].valid) {
-	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f\n", 
+	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f", 
 		   i,
 		   "yes",
 		   stats[i].util*100.0,
 		   stats[i].ops,
 		   stats[i].secs,
 		   (stats[i].ops/1e3)/stats[i].secs);
+	    if (stats[i].peak > 0)
+		printf("%9.0f%9.0f%7.0f", stats[i].peak/1024, stats[i].final/1024,
+		       stats[i].resident/1024);
+	    else
+		printf("%9s%9s%7s", "-", "-", "-");
+	    printf("%8.0f\n", stats[i].faults);
 	    secs += stats[i].secs;
 	    ops += stats[i].ops;
 	    util += stats[i].util;
@@ -976,13 +1892,42 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+#ifdef MM_THREADS
+    fprintf(stderr, "Usage: mdriver [-hvValzbLSYPH] [-f <file>] [-t <dir>] [-F <fit>] [-M <MB>] [-T <n>] [-X <n>]\n");
+#else
+    fprintf(stderr, "Usage: mdriver [-hvValzbLSYPH] [-f <file>] [-t <dir>] [-F <fit>] [-M <MB>]\n");
+#endif
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-z         Free with mm_free_sized and the size from the trace.\n");
+    fprintf(stderr, "\t-b         Replay runs of same-size allocs and of frees in batches.\n");
+    fprintf(stderr, "\t-L         Time each request on its own and report the slowest.\n");
+    fprintf(stderr, "\t-F <fit>   Fit policy: first, next, best or good[:K[:X]].\n");
+    fprintf(stderr, "\t-S         Run each trace under every fit policy and mark the best.\n");
+    fprintf(stderr, "\t-Y         Grade the lifetime predictor and show its util gain.\n");
+    fprintf(stderr, "\t-P         Prefault the heap as it grows (MAP_POPULATE).\n");
+    fprintf(stderr, "\t-H         Use transparent huge pages for the heap.\n");
+    fprintf(stderr, "\t-M <MB>    Address space for all heap segments together.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+#ifdef MM_THREADS
+    fprintf(stderr, "\t-T <n>     Replay each trace in n threads at once.\n");
+    fprintf(stderr, "\t-X <n>     Cross-thread free test with 1 to n threads.\n");
+#endif
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
 }
+
+/*
+ * page_faults - Return the number of page faults this process has taken
+ */
+static long page_faults(void)
+{
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_SELF, &ru) < 0)
+	unix_error("getrusage failed");
+    return ru.ru_minflt + ru.ru_majflt;
+}
@@ -3,6 +3,7 @@
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
  */
+#define _GNU_SOURCE /* for mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -18,20 +19,89 @@
 static char *mem_start_brk;  /* points to first byte of heap */
 static char *mem_brk;        /* points to last byte of heap */
 static char *mem_max_addr;   /* largest legal heap address */ 
+static size_t mem_peak;      /* largest heap plus mapped size since the last reset */
+static char *mem_commit_brk; /* end of the committed part of the heap */
+static char *mem_seg_start;  /* first byte of the current segment */
+static char *mem_seg_limit;  /* end of the current segment */
+static char *mem_used_brk;   /* highest brk so far */
+static char *mem_fresh_brk;  /* highest brk before the last reset; the heap above it is still zero */
+static size_t mem_reserved = MEM_RESERVE; /* bytes of address space for all segments */
+static int mem_opts;         /* MEM_POPULATE, MEM_HUGEPAGE */
+
+/* regions from mem_map, which live outside the heap */
+typedef struct {
+    char *addr;
+    size_t len;
+} mapping_t;
+static mapping_t *mem_maps;  /* the live mappings, in no order */
+static int mem_nmaps;
+static int mem_maxmaps;
+static size_t mem_mapped;    /* bytes in all live mappings */
+
+/* the heap is committed in steps of MEM_COMMIT bytes, the size of a huge page */
+#define MEM_COMMIT (1 << 21)
+
+#define MAX(x, y) ((x) > (y) ? (x) : (y))
+
+/* mem_note_peak - remember the size of the heap and mappings if it is a new peak */
+static void mem_note_peak(void)
+{
+    if ((size_t)(mem_brk - mem_start_brk) + mem_mapped > mem_peak)
+	mem_peak = (mem_brk - mem_start_brk) + mem_mapped;
+}
+
+/*
+ * mem_options - set the MEM_xxx options of the heap; call before mem_init
+ */
+void mem_options(int opts)
+{
+    mem_opts = opts;
+}
+
+/*
+ * mem_reserve - set how many bytes of address space the heap may use in
+ *    all of its segments together; call before mem_init
+ */
+void mem_reserve(size_t bytes)
+{
+    mem_reserved = bytes;
+}
 
 /* 
  * mem_init - initialize the memory system model
+ *    The heap is only reserved here (PROT_NONE), and mem_sbrk commits
+ *    it as the brk grows. The reservation is aligned to MEM_COMMIT so
+ *    that huge pages can back it. It holds the segments of the heap,
+ *    one after the other; the first one is MAX_HEAP bytes.
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
+    char *p, *start;
+    size_t len;
+
+    mem_reserved = (MAX(mem_reserved, MAX_HEAP) + MEM_COMMIT - 1) & ~(size_t)(MEM_COMMIT - 1);
+    len = mem_reserved + MEM_COMMIT;
+
+    /* reserve the address space we will use to model the available VM */
+    if ((p = mmap(NULL, len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, 
+		  -1, 0)) == MAP_FAILED) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
 	exit(1);
     }
+    start = (char *)(((uintptr_t)p + MEM_COMMIT - 1) & ~(uintptr_t)(MEM_COMMIT - 1));
+    if (start > p)
+	munmap(p, start - p);
+    if (start + mem_reserved < p + len)
+	munmap(start + mem_reserved, p + len - (start + mem_reserved));
+    if ((mem_opts & MEM_HUGEPAGE) && (madvise(start, mem_reserved, MADV_HUGEPAGE) < 0))
+	fprintf(stderr, "mem_init_vm: no transparent huge pages (%s)\n", strerror(errno));
 
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
+    mem_start_brk = start;
+    mem_max_addr = mem_start_brk + mem_reserved;  /* max legal heap address */
+    mem_commit_brk = mem_start_brk;
+    mem_used_brk = mem_start_brk;
+    mem_nmaps = 0;
+    mem_reset_brk();                              /* heap is empty initially */
 }
 
 /* 
@@ -39,35 +109,279 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    mem_reset_brk();
+    munmap(mem_start_brk, mem_reserved);
+    free(mem_maps);
+}
+
+/*
+ * mem_commit - make the heap up to end readable and writable. With
+ *    MEM_POPULATE the new pages are faulted in right away, so the
+ *    allocator does not take the faults later. The committed part
+ *    never shrinks, not even on mem_reset_brk.
+ */
+static int mem_commit(char *end)
+{
+    char *p = mem_commit_brk;
+    size_t len;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED;
+
+    end = mem_start_brk + ((end - mem_start_brk + MEM_COMMIT - 1) & ~(size_t)(MEM_COMMIT - 1));
+    if (end > mem_max_addr)
+	end = mem_max_addr;
+    len = end - p;
+
+    /* MAP_FIXED replaces the reservation, which drops MADV_HUGEPAGE, so huge pages are populated by hand */
+    if ((mem_opts & MEM_POPULATE) && !(mem_opts & MEM_HUGEPAGE))
+	flags |= MAP_POPULATE;
+    if (mmap(p, len, PROT_READ | PROT_WRITE, flags, -1, 0) == MAP_FAILED)
+	return -1;
+    if (mem_opts & MEM_HUGEPAGE) {
+	madvise(p, len, MADV_HUGEPAGE);
+	if (mem_opts & MEM_POPULATE) {
+	    size_t pagesize = mem_pagesize();
+	    char *q;
+	    for (q = p; q < end; q += pagesize)
+		*(volatile char *)q = 0;
+	}
+    }
+    mem_commit_brk = end;
+    return 0;
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointer to make an empty heap,
+ *    and drop the mappings the allocator still has
  */
 void mem_reset_brk()
 {
+    while (mem_nmaps > 0) {
+	mem_nmaps--;
+	munmap(mem_maps[mem_nmaps].addr, mem_maps[mem_nmaps].len);
+    }
+    mem_mapped = 0;
     mem_brk = mem_start_brk;
+    mem_fresh_brk = mem_used_brk;
+    mem_peak = 0;
+    mem_seg_start = mem_start_brk;
+    mem_seg_limit = mem_start_brk + MAX_HEAP;
 }
 
 /* 
- * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ * mem_sbrk - simple model of the sbrk function. Extends the current 
+ *    segment of the heap by incr bytes and returns the start address 
+ *    of the new area, committing more of the reserved heap when needed.
+ *    A negative incr shrinks the segment, but not below its start, and
+ *    returns the old brk like sbrk does; the whole pages it gives up go
+ *    back to the kernel but stay committed. Once the segment is full, 
+ *    mem_sbrk fails quietly with ENOMEM, and mem_segment can start a 
+ *    new one.
  */
-void *mem_sbrk(int incr) 
+void *mem_sbrk(intptr_t incr) 
 {
     char *old_brk = mem_brk;
+    uintptr_t pagesize = mem_pagesize();
+    char *lo, *hi;
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+    if (incr < 0) {
+	if (-incr > mem_brk - mem_seg_start) {
+	    errno = EINVAL;
+	    fprintf(stderr, "ERROR: mem_sbrk failed. Shrinking below the segment start...\n");
+	    return (void *)-1;
+	}
+	lo = (char *)(((uintptr_t)mem_brk + incr + pagesize - 1) & ~(pagesize - 1));
+	hi = (char *)(((uintptr_t)mem_brk + pagesize - 1) & ~(pagesize - 1));
+	if (hi > lo)
+	    mem_decommit(lo, hi - lo);
+    }
+    else if (incr > mem_seg_limit - mem_brk) {
 	errno = ENOMEM;
-	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+	return (void *)-1;
+    }
+    else if ((mem_brk + incr > mem_commit_brk) && (mem_commit(mem_brk + incr) < 0)) {
+	errno = ENOMEM;
+	fprintf(stderr, "ERROR: mem_sbrk failed. Could not commit memory...\n");
 	return (void *)-1;
     }
     mem_brk += incr;
+    if (mem_brk > mem_used_brk)
+	mem_used_brk = mem_brk;
+    mem_note_peak();
     return (void *)old_brk;
 }
 
+/*
+ * mem_segment - start a new segment of the heap at the brk and extend
+ *    it by incr bytes, like mem_sbrk does. The segment is MAX_HEAP 
+ *    bytes, or incr if that is larger. The allocator should treat it 
+ *    as a separate heap: nothing it has before the old brk continues 
+ *    into the new segment.
+ */
+void *mem_segment(intptr_t incr)
+{
+    size_t size = MAX(incr, MAX_HEAP);
+
+    if ((incr < 0) || (size > (size_t)(mem_max_addr - mem_brk))) {
+	errno = ENOMEM;
+	fprintf(stderr, "ERROR: mem_segment failed. Ran out of memory...\n");
+	return (void *)-1;
+    }
+    mem_seg_start = mem_brk;
+    mem_seg_limit = mem_brk + size;
+    return mem_sbrk(incr);
+}
+
+/*
+ * mem_find_map - return the index of the mapping that starts at addr, or -1
+ */
+static int mem_find_map(char *addr)
+{
+    int i;
+
+    for (i = mem_nmaps - 1; i >= 0; i--)
+	if (mem_maps[i].addr == addr)
+	    return i;
+    return -1;
+}
+
+/*
+ * mem_map - model of an anonymous mmap: returns a new page-aligned 
+ *    region of len bytes outside the heap, or (void *)-1. It counts 
+ *    towards the peak heap size like the heap does.
+ */
+void *mem_map(size_t len)
+{
+    char *p;
+
+    if (mem_nmaps == mem_maxmaps) {
+	int max = mem_maxmaps ? 2 * mem_maxmaps : 64;
+	mapping_t *maps = realloc(mem_maps, max * sizeof(mapping_t));
+	if (maps == NULL)
+	    return (void *)-1;
+	mem_maps = maps;
+	mem_maxmaps = max;
+    }
+    if ((p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, 
+		  -1, 0)) == MAP_FAILED) {
+	fprintf(stderr, "ERROR: mem_map failed. Ran out of memory...\n");
+	return (void *)-1;
+    }
+    mem_maps[mem_nmaps].addr = p;
+    mem_maps[mem_nmaps].len = len;
+    mem_nmaps++;
+    mem_mapped += len;
+    mem_note_peak();
+    return (void *)p;
+}
+
+/*
+ * mem_unmap - release a whole region returned by mem_map
+ */
+int mem_unmap(void *addr)
+{
+    int i = mem_find_map(addr);
+
+    if (i < 0) {
+	errno = EINVAL;
+	return -1;
+    }
+    munmap(addr, mem_maps[i].len);
+    mem_mapped -= mem_maps[i].len;
+    mem_maps[i] = mem_maps[--mem_nmaps];
+    return 0;
+}
+
+/*
+ * mem_remap - resize a region returned by mem_map with mremap, so its 
+ *    pages move without being copied. Returns the (possibly new) 
+ *    address of the region, or (void *)-1.
+ */
+void *mem_remap(void *addr, size_t len)
+{
+    int i = mem_find_map(addr);
+    char *p;
+
+    if (i < 0) {
+	errno = EINVAL;
+	return (void *)-1;
+    }
+    if ((p = mremap(addr, mem_maps[i].len, len, MREMAP_MAYMOVE)) == MAP_FAILED)
+	return (void *)-1;
+    mem_mapped += len - mem_maps[i].len;
+    mem_maps[i].addr = p;
+    mem_maps[i].len = len;
+    mem_note_peak();
+    return (void *)p;
+}
+
+/*
+ * mem_in_map - whether lo..hi lies inside a single mapping
+ */
+int mem_in_map(void *lo, void *hi)
+{
+    int i;
+
+    for (i = 0; i < mem_nmaps; i++)
+	if (((char *)lo >= mem_maps[i].addr) && 
+	    ((char *)hi < mem_maps[i].addr + mem_maps[i].len))
+	    return 1;
+    return 0;
+}
+
+/*
+ * mem_mapsize() - returns the bytes in all regions from mem_map
+ */
+size_t mem_mapsize() 
+{
+    return mem_mapped;
+}
+
+/*
+ * mem_decommit - give the pages in addr..addr+len back to the kernel 
+ *    (MADV_DONTNEED); they read as zero the next time they are touched.
+ *    addr and len must be multiples of the page size.
+ */
+int mem_decommit(void *addr, size_t len)
+{
+    return madvise(addr, len, MADV_DONTNEED);
+}
+
+/*
+ * mem_resident_range - count the resident pages in addr..addr+len
+ */
+static size_t mem_resident_range(char *addr, size_t len)
+{
+    size_t pagesize = mem_pagesize();
+    size_t npages = (len + pagesize - 1) / pagesize;
+    size_t i, n = 0;
+    unsigned char *vec;
+
+    if (npages == 0)
+	return 0;
+    if ((vec = malloc(npages)) == NULL)
+	return 0;
+    if (mincore(addr, len, vec) == 0)
+	for (i = 0; i < npages; i++)
+	    n += vec[i] & 1;
+    free(vec);
+    return n;
+}
+
+/*
+ * mem_resident - returns how many pages of the heap and of the mappings
+ *    are resident in memory (mincore). The heap is counted up to the
+ *    highest brk so far, as pages above a trimmed brk may still be.
+ */
+size_t mem_resident()
+{
+    size_t n = mem_resident_range(mem_start_brk, mem_used_brk - mem_start_brk);
+    int i;
+
+    for (i = 0; i < mem_nmaps; i++)
+	n += mem_resident_range(mem_maps[i].addr, mem_maps[i].len);
+    return n;
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -84,6 +398,16 @@ void *mem_heap_hi()
     return (void *)(mem_brk - 1);
 }
 
+/*
+ * mem_fresh_lo - return the lowest heap address that no run before the
+ *    last mem_reset_brk has been given. The committed heap is never
+ *    given back, so only the memory from here up is known to be zero.
+ */
+void *mem_fresh_lo()
+{
+    return (void *)mem_fresh_brk;
+}
+
 /*
  * mem_heapsize() - returns the heap size in bytes
  */
@@ -92,6 +416,15 @@ size_t mem_heapsize()
     return (size_t)(mem_brk - mem_start_brk);
 }
 
+/*
+ * mem_peak_heapsize() - returns the largest heap size, mappings included,
+ *    since the last reset
+ */
+size_t mem_peak_heapsize() 
+{
+    return mem_peak;
+}
+
 /*
  * mem_pagesize() - returns the page size of the system
  */
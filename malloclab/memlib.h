@@ -1,11 +1,28 @@
 #include <unistd.h>
+#include <stdint.h>
 
+/* mem_options flags */
+#define MEM_POPULATE 0x1 /* fault committed pages in at once (MAP_POPULATE) */
+#define MEM_HUGEPAGE 0x2 /* back the heap with transparent huge pages (MADV_HUGEPAGE) */
+
+void mem_options(int opts);
+void mem_reserve(size_t bytes);
 void mem_init(void);               
 void mem_deinit(void);
-void *mem_sbrk(int incr);
+void *mem_sbrk(intptr_t incr);
+void *mem_segment(intptr_t incr);
+void *mem_map(size_t len);
+int mem_unmap(void *addr);
+void *mem_remap(void *addr, size_t len);
+int mem_in_map(void *lo, void *hi);
+size_t mem_mapsize(void);
+int mem_decommit(void *addr, size_t len);
+size_t mem_resident(void);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
+void *mem_fresh_lo(void);
 size_t mem_heapsize(void);
+size_t mem_peak_heapsize(void);
 size_t mem_pagesize(void);
 
@@ -0,0 +1,566 @@
+/*
+ * mm-tlsf.c - memory allocation by two-level segregated fit (TLSF)
+ *
+ * The same mm.h interface as mm.c, for callers that need a bound on the cost of every
+ * single call rather than the best average. Build it in place of mm.c (make mdriver-tlsf).
+ *
+ * Free blocks sit in LIFO lists picked by two indexes: the first level is the power of two
+ * below the block size, the second level splits that range into SL_COUNT equal parts.
+ * A bitmap per level says which lists are non-empty, so malloc finds a list whose every
+ * block fits with two bit scans, and free puts a block at the head of its list. Neither
+ * walks a list, there is no sorted insert, and coalescing looks at two neighbours only.
+ * Growing the heap on a miss takes one mem_sbrk. Single-threaded; no slabs or quick-lists.
+ */
+
+/*
+ * Programming Rules
+ * 1. Do not define global or static compound data structures (struct, array, union ...)
+ * 2. Do not use memory management related library calls or system calls (mmap, malloc, free, brk, ...)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "config.h"
+
+/* rounds up to the nearest multiple of ALIGNMENT */
+#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~(size_t)(ALIGNMENT-1))
+
+// Sizes
+#define WSIZE 4 // word size (header and footer)
+#define DSIZE 8 // double word size
+#if defined(__LP64__) && !defined(FULL_LINKS)
+#define LSIZE WSIZE // free list links are 32-bit heap offsets (see SET), so MSIZE stays 16B
+#else
+#define LSIZE (sizeof(void *)) // free list link size
+#endif
+#define MSIZE ALIGN(DSIZE + 2*LSIZE) // minimum free block size: header, two links and footer
+#define MAX_REQUEST ((size_t)0xFFFFFFFF - 2*ALIGNMENT) // block sizes must fit in a header word
+#define MPAYLOAD (MSIZE - WSIZE) // minimum payload size
+
+// MACROs for mm-tlsf.c
+#define MAX(x, y) ((x) > (y)? (x) : (y))
+#define MIN(x ,y) ((x) < (y)? (x) : (y))
+
+#define PACK(size, alloc)  ((size) | (alloc))
+
+#define GET(p)       (*(unsigned int *)(p))
+#define PUT(p, val)  (*(unsigned int *)(p) = (val))
+#if defined(__LP64__) && !defined(FULL_LINKS)
+// a link holds (bp - heap_listp) / ALIGNMENT; 0 is NULL, as no block starts at heap_listp. SET evaluates bp twice.
+#define SET(p, bp)   PUT(p, (bp) ? (unsigned int)(((char *)(bp) - heap_listp) / ALIGNMENT) : 0)
+#define LINK(p)      (GET(p) ? heap_listp + (size_t)GET(p) * ALIGNMENT : NULL)
+#else
+#define SET(p, bp)   (*(char **)(p) = (char *)(bp))
+#define LINK(p)      (*(char **)(p))
+#endif
+
+#define GET_SIZE(p)  (GET(p) & ~0x7)
+#define GET_ALLOC(p) (GET(p) & 0x1)
+
+// bit 1 of a header tells whether the previous block is allocated, so only free blocks need a footer.
+#define PREV_ALLOC 0x2
+#define GET_PREV_ALLOC(p) (GET(p) & PREV_ALLOC)
+#define SET_PREV_ALLOC(p) PUT(p, GET(p) | PREV_ALLOC)
+#define CLR_PREV_ALLOC(p) PUT(p, GET(p) & ~PREV_ALLOC)
+
+#define HDRP(bp)        ((char *)(bp) - WSIZE)
+#define FTRP(bp)        ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE) // free blocks only
+
+#define NEXT_BLKP(bp)   ((char *)(bp) + GET_SIZE(((char*)(bp) - WSIZE)))
+#define PREV_BLKP(bp)   ((char *)(bp) - GET_SIZE(((char*)(bp) - DSIZE))) // only if the previous block is free
+#define SUCC(bp)   LINK(bp)
+#define PRED(bp)   LINK((char *)(bp) + LSIZE)
+
+// two-level index. sizes below SMALL_BLOCK all share first level 0, in exact ALIGNMENT steps;
+// above it, first level f holds [2^(f+FL_SHIFT-1), 2^(f+FL_SHIFT)) cut into SL_COUNT lists,
+// up to the 32-bit sizes a header can hold.
+#define SL_LOG2 4
+#define SL_COUNT (1 << SL_LOG2)
+#define ALIGN_LOG2 (__builtin_ctz(ALIGNMENT))
+#define FL_SHIFT (SL_LOG2 + ALIGN_LOG2)
+#define SMALL_BLOCK ((size_t)1 << FL_SHIFT)
+#define FL_COUNT (32 - FL_SHIFT + 1)
+#define MSB(x) (31 - __builtin_clz((unsigned int)(x)))
+
+// control block at the start of the heap: the first-level bitmap, one second-level bitmap
+// per first level, and the list heads, which are links like the ones in the blocks.
+#define FL_MAP        GET(heap_listp)
+#define SL_MAP(f)     GET(heap_listp + WSIZE * (1 + (f)))
+#define HEADP(f, s)   (heap_listp + WSIZE * (1 + FL_COUNT) + LSIZE * ((f) * SL_COUNT + (s)))
+#define HEAD(f, s)    LINK(HEADP(f, s))
+#define CTRL_SIZE     ALIGN(WSIZE * (1 + FL_COUNT) + LSIZE * FL_COUNT * SL_COUNT)
+
+/*
+ * Requests of MMAP_THRESHOLD bytes or more get a region of their own from mem_map, as in mm.c:
+ * the word before the header holds the page count, and the header says size 0.
+ */
+#define MAP_PAGE (1 << 12)
+#define PAGE_DOWN(p) ((char *)((size_t)(p) & ~(size_t)(MAP_PAGE - 1)))
+#define MAP_PAGES(bp) GET((char *)(bp) - DSIZE)
+#define MAP_BASE(bp)  PAGE_DOWN((char *)(bp) - DSIZE)
+#define IS_MAPPED(bp) (GET_SIZE(HDRP(bp)) == 0)
+
+// global variables
+static char *heap_listp = 0; // start of the heap: the control block, also the base of 32-bit links
+static char *heap_brk; // first byte after the epilogue header
+
+// helper functions
+static void mapping(size_t size, int *f, int *s);
+static void *heap_alloc(size_t adjsize);
+static void *find_fit(size_t adjsize);
+static void add_node(void *bp);
+static void remove_node(void *bp);
+static void *extend_heap(size_t adjsize);
+static void *coalesce(void *bp);
+static void split(void *bp, size_t adjsize);
+static void *map_alloc(size_t size, size_t align);
+static void map_free(void *ptr);
+static void *map_realloc(void *ptr, size_t size);
+
+/*
+ * mm_init - creates an empty heap: the control block and an epilogue header
+ */
+int mm_init(void)
+{
+    if ((heap_listp = mem_sbrk(CTRL_SIZE + ALIGNMENT)) == (void *)-1) return -1;
+    memset(heap_listp, 0, CTRL_SIZE);
+    heap_brk = heap_listp + CTRL_SIZE + ALIGNMENT;
+    PUT(HDRP(heap_brk), PACK(0, 1) | PREV_ALLOC); // nothing before the first block to merge with
+    return 0;
+}
+
+/*
+ * mm_malloc - Take the head of the first non-empty list whose blocks all fit, or grow the heap
+ */
+void *mm_malloc(size_t size)
+{
+    size_t adjsize;
+
+    if (heap_listp == 0) mm_init();
+    if ((size == 0) || (size > MAX_REQUEST)) return NULL;
+    if (size >= MMAP_THRESHOLD) return map_alloc(size, ALIGNMENT);
+    if (size <= MPAYLOAD) adjsize = MSIZE;
+    else adjsize = ALIGN(WSIZE + size);
+
+    return heap_alloc(adjsize);
+}
+
+/*
+ * mm_free - Merge the block with its free neighbours and put it at the head of its list
+ */
+void mm_free(void *ptr)
+{
+    if (ptr == NULL) return;
+    if (IS_MAPPED(ptr))
+    {
+        map_free(ptr);
+        return;
+    }
+    PUT(HDRP(ptr), PACK(GET_SIZE(HDRP(ptr)), 0) | GET_PREV_ALLOC(HDRP(ptr)));
+    PUT(FTRP(ptr), PACK(GET_SIZE(HDRP(ptr)), 0));
+    CLR_PREV_ALLOC(HDRP(NEXT_BLKP(ptr)));
+    add_node(coalesce(ptr));
+}
+
+/*
+ * mm_realloc - Shrink or grow the block in place when its neighbour allows it, else move it
+ */
+void *mm_realloc(void *ptr, size_t size)
+{
+    size_t adjsize, csize, nsize;
+    char *next, *newptr;
+
+    if (ptr == NULL) return mm_malloc(size);
+    if (size == 0)
+    {
+        mm_free(ptr);
+        return NULL;
+    }
+    if (size > MAX_REQUEST) return NULL;
+    if (IS_MAPPED(ptr)) return map_realloc(ptr, size);
+    if (size >= MMAP_THRESHOLD)
+    {
+        if ((newptr = map_alloc(size, ALIGNMENT)) == NULL) return NULL;
+        memcpy(newptr, ptr, MIN(GET_SIZE(HDRP(ptr)) - WSIZE, size));
+        mm_free(ptr);
+        return newptr;
+    }
+    if (size <= MPAYLOAD) adjsize = MSIZE;
+    else adjsize = ALIGN(WSIZE + size);
+
+    csize = GET_SIZE(HDRP(ptr));
+    next = NEXT_BLKP(ptr);
+    if (csize < adjsize)
+    {
+        if (!GET_ALLOC(HDRP(next)) && (csize + (nsize = GET_SIZE(HDRP(next))) >= adjsize))
+        {
+            remove_node(next);
+            csize += nsize;
+        }
+        else if ((next == heap_brk) && (mem_sbrk(adjsize - csize) != (void *)-1)) // the last block grows with the heap
+        {
+            heap_brk += adjsize - csize;
+            PUT(HDRP(heap_brk), PACK(0, 1)); // new epilogue
+            csize = adjsize;
+        }
+        else
+        {
+            if ((newptr = mm_malloc(size)) == NULL) return NULL;
+            memcpy(newptr, ptr, GET_SIZE(HDRP(ptr)) - WSIZE);
+            mm_free(ptr);
+            return newptr;
+        }
+        PUT(HDRP(ptr), PACK(csize, 1) | GET_PREV_ALLOC(HDRP(ptr)));
+        SET_PREV_ALLOC(HDRP(NEXT_BLKP(ptr)));
+    }
+    split(ptr, adjsize);
+    return ptr;
+}
+
+/*
+ * mm_memalign - Allocate a block whose payload is a multiple of alignment (a power of two)
+ */
+void *mm_memalign(size_t alignment, size_t size)
+{
+    size_t adjsize, gap;
+    char *bp, *p;
+
+    if ((alignment == 0) || (alignment & (alignment - 1))) return NULL; // must be a power of two
+    if (alignment <= ALIGNMENT) return mm_malloc(size); // every block is aligned this much
+    if (heap_listp == 0) mm_init();
+    if ((size == 0) || (alignment > MAX_REQUEST) || (size > MAX_REQUEST - alignment - MSIZE)) return NULL;
+    if ((size + alignment >= MMAP_THRESHOLD) && (alignment <= MAP_PAGE)) return map_alloc(size, alignment);
+    if (size <= MPAYLOAD) adjsize = MSIZE;
+    else adjsize = ALIGN(WSIZE + size);
+
+    // the block has an aligned payload with room for a free block in front of it
+    if ((bp = heap_alloc(adjsize + alignment + MSIZE)) == NULL) return NULL;
+    p = (char *)(((size_t)bp + alignment - 1) & ~(alignment - 1));
+    if ((p != bp) && ((size_t)(p - bp) < MSIZE)) p += alignment;
+    if (p != bp)
+    {
+        // the block before bp is allocated, so the gap goes to its list as it is
+        gap = p - bp;
+        PUT(HDRP(p), PACK(GET_SIZE(HDRP(bp)) - gap, 1));
+        PUT(HDRP(bp), PACK(gap, 0) | GET_PREV_ALLOC(HDRP(bp)));
+        PUT(FTRP(bp), PACK(gap, 0));
+        add_node(bp);
+    }
+    split(p, adjsize);
+    return p;
+}
+
+/*
+ * mm_aligned_alloc - C11 aligned_alloc; like mm_memalign, and size need not be a multiple of alignment
+ */
+void *mm_aligned_alloc(size_t alignment, size_t size)
+{
+    return mm_memalign(alignment, size);
+}
+
+/*
+ * mm_calloc - Allocate a zeroed array of nmemb elements of size bytes
+ */
+void *mm_calloc(size_t nmemb, size_t size)
+{
+    void *bp;
+
+    if ((nmemb != 0) && (size > MAX_REQUEST / nmemb)) return NULL; // nmemb * size would overflow or be too large
+    if ((bp = mm_malloc(nmemb * size)) == NULL) return NULL;
+    if (!IS_MAPPED(bp)) memset(bp, 0, nmemb * size); // a new mapping is zero already
+    return bp;
+}
+
+/*
+ * mm_free_sized - Free a block that was allocated with a payload of size bytes; the header is read anyway
+ */
+void mm_free_sized(void *ptr, size_t size)
+{
+#ifdef MM_DEBUG
+    assert((ptr == NULL) || (size <= mm_usable_size(ptr)));
+#endif
+    (void)size;
+    mm_free(ptr);
+}
+
+/*
+ * mm_usable_size - The number of bytes the caller may use at ptr, at least what it asked for
+ */
+size_t mm_usable_size(void *ptr)
+{
+    if (ptr == NULL) return 0;
+    if (IS_MAPPED(ptr)) return MAP_PAGES(ptr) * MAP_PAGE - ((char *)ptr - MAP_BASE(ptr));
+    return GET_SIZE(HDRP(ptr)) - WSIZE;
+}
+
+/*
+ * mm_malloc_batch - Allocate n blocks of size bytes into out; returns how many it got.
+ * Each block is an O(1) mm_malloc, which keeps the bound per block.
+ */
+int mm_malloc_batch(size_t size, int n, void **out)
+{
+    int k;
+
+    for (k = 0; k < n; k++) if ((out[k] = mm_malloc(size)) == NULL) break;
+    return k;
+}
+
+/*
+ * mm_free_batch - Free n blocks
+ */
+void mm_free_batch(void **ptrs, int n)
+{
+    int k;
+
+    for (k = 0; k < n; k++) mm_free(ptrs[k]);
+}
+
+/*
+ * mm_malloc_site - There is no lifetime predictor here, so the site hint is ignored
+ */
+void *mm_malloc_site(size_t size, int site)
+{
+    return mm_malloc(size);
+}
+
+/*
+ * mm_lifetime - Nothing is predicted
+ */
+int mm_lifetime(size_t size, int site)
+{
+    return -1;
+}
+
+/*
+ * heap_alloc - Allocate a block of adjsize bytes in the heap, growing it on a miss
+ */
+static void *heap_alloc(size_t adjsize)
+{
+    char *bp;
+
+    if ((bp = find_fit(adjsize)) == NULL)
+    {
+        if ((bp = extend_heap(adjsize)) == NULL) return NULL;
+    }
+    else remove_node(bp);
+    split(bp, adjsize);
+    return bp;
+}
+
+/*
+ * mapping - The list a block of size bytes belongs to
+ */
+static void mapping(size_t size, int *f, int *s)
+{
+    int fl;
+
+    if (size < SMALL_BLOCK)
+    {
+        *f = 0;
+        *s = (int)(size >> ALIGN_LOG2);
+        return;
+    }
+    fl = MSB(size);
+    *s = (int)(size >> (fl - SL_LOG2)) - SL_COUNT;
+    *f = fl - FL_SHIFT + 1;
+}
+
+/*
+ * find_fit - A free block of at least adjsize bytes, found with two bit scans. The size is rounded up
+ * to the next list boundary first, so any block of the list picked fits without looking at it.
+ */
+static void *find_fit(size_t adjsize)
+{
+    size_t round;
+    unsigned int map;
+    int f, s;
+
+    if (adjsize >= SMALL_BLOCK)
+    {
+        round = ((size_t)1 << (MSB(adjsize) - SL_LOG2)) - 1;
+        if (adjsize > (size_t)0xFFFFFFFF - round) return NULL; // no block is that large
+        adjsize += round;
+    }
+    mapping(adjsize, &f, &s);
+
+    map = SL_MAP(f) & (~0u << s);
+    if (map == 0)
+    {
+        map = (f + 1 < FL_COUNT) ? FL_MAP & (~0u << (f + 1)) : 0;
+        if (map == 0) return NULL;
+        f = __builtin_ctz(map);
+        map = SL_MAP(f);
+    }
+    s = __builtin_ctz(map);
+    //printf("Find: %u bytes from list (%d, %d)\n", (unsigned)adjsize, f, s);
+    return HEAD(f, s);
+}
+
+/*
+ * add_node - Put a free block at the head of its list
+ */
+static void add_node(void *bp)
+{
+    char *head;
+    int f, s;
+
+    mapping(GET_SIZE(HDRP(bp)), &f, &s);
+    head = HEAD(f, s);
+    SET(bp, head);
+    SET((char *)bp + LSIZE, NULL);
+    if (head != NULL) SET(head + LSIZE, bp);
+    SET(HEADP(f, s), bp);
+    FL_MAP |= 1u << f;
+    SL_MAP(f) |= 1u << s;
+}
+
+/*
+ * remove_node - Unlink a free block from its list
+ */
+static void remove_node(void *bp)
+{
+    char *succ = SUCC(bp), *pred = PRED(bp);
+    int f, s;
+
+    if (succ != NULL) SET(succ + LSIZE, pred);
+    if (pred != NULL)
+    {
+        SET(pred, succ);
+        return;
+    }
+    mapping(GET_SIZE(HDRP(bp)), &f, &s);
+    SET(HEADP(f, s), succ);
+    if (succ == NULL)
+    {
+        SL_MAP(f) &= ~(1u << s);
+        if (SL_MAP(f) == 0) FL_MAP &= ~(1u << f);
+    }
+}
+
+/*
+ * extend_heap - Grow the heap by one mem_sbrk so that it ends with a free block of at least adjsize bytes,
+ * counting the free block at the end of the heap. Returns that block, out of its list.
+ */
+static void *extend_heap(size_t adjsize)
+{
+    char *bp = heap_brk;
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    size_t have = 0;
+
+    if (!prev_alloc)
+    {
+        bp = PREV_BLKP(bp);
+        have = GET_SIZE(HDRP(bp));
+        prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+        remove_node(bp);
+        if (have >= adjsize) return bp; // find_fit rounds up, so it can miss a block that fits
+    }
+    if (mem_sbrk(adjsize - have) != (void *)-1) heap_brk += adjsize - have;
+    else
+    {
+        // the segment is full, so the block starts a new one, and the free block at the end of the old one stays
+        if (have) add_node(bp);
+        if ((bp = mem_segment(adjsize + ALIGNMENT)) == (void *)-1) return NULL;
+        bp += ALIGNMENT;
+        heap_brk = bp + adjsize;
+        prev_alloc = PREV_ALLOC;
+    }
+    PUT(HDRP(bp), PACK(adjsize, 0) | prev_alloc);
+    PUT(FTRP(bp), PACK(adjsize, 0));
+    PUT(HDRP(heap_brk), PACK(0, 1)); // new epilogue
+    return bp;
+}
+
+/*
+ * coalesce - Merge a free block with its free neighbours, taking them out of their lists
+ */
+static void *coalesce(void *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    char *next = NEXT_BLKP(bp);
+
+    if (!GET_ALLOC(HDRP(next)))
+    {
+        remove_node(next);
+        size += GET_SIZE(HDRP(next));
+    }
+    if (!GET_PREV_ALLOC(HDRP(bp)))
+    {
+        bp = PREV_BLKP(bp);
+        remove_node(bp);
+        size += GET_SIZE(HDRP(bp));
+    }
+    PUT(HDRP(bp), PACK(size, 0) | GET_PREV_ALLOC(HDRP(bp)));
+    PUT(FTRP(bp), PACK(size, 0));
+    return bp;
+}
+
+/*
+ * split - Make bp an allocated block of adjsize bytes; a remainder large enough for a block is freed.
+ * bp is in no list, and its header holds its size and its prev bit.
+ */
+static void split(void *bp, size_t adjsize)
+{
+    size_t csize = GET_SIZE(HDRP(bp));
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    char *rest;
+
+    if (csize - adjsize < MSIZE)
+    {
+        PUT(HDRP(bp), PACK(csize, 1) | prev_alloc);
+        SET_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+        return;
+    }
+    PUT(HDRP(bp), PACK(adjsize, 1) | prev_alloc);
+    rest = NEXT_BLKP(bp);
+    PUT(HDRP(rest), PACK(csize - adjsize, 0) | PREV_ALLOC);
+    PUT(FTRP(rest), PACK(csize - adjsize, 0));
+    CLR_PREV_ALLOC(HDRP(NEXT_BLKP(rest)));
+    add_node(coalesce(rest)); // only a realloc shrink can leave a free block after it
+}
+
+/* map_alloc - give a huge request a region of its own, with the payload align (a power of two up to MAP_PAGE) bytes in */
+static void *map_alloc(size_t size, size_t align)
+{
+    size_t offset = MAX(align, ALIGNMENT);
+    size_t pages = (size + offset + MAP_PAGE - 1) / MAP_PAGE;
+    char *p;
+
+    if ((p = mem_map(pages * MAP_PAGE)) == (void *)-1) return NULL;
+    PUT(p + offset - DSIZE, pages);
+    PUT(p + offset - WSIZE, PACK(0, 1));
+    return p + offset;
+}
+
+/* map_free - give the region of a huge block back right away */
+static void map_free(void *ptr)
+{
+    mem_unmap(MAP_BASE(ptr));
+}
+
+/* map_realloc - resize a huge block with mem_remap, which moves pages instead of copying; a small one goes back to the heap */
+static void *map_realloc(void *ptr, size_t size)
+{
+    size_t offset = (char *)ptr - MAP_BASE(ptr);
+    size_t pages = (size + offset + MAP_PAGE - 1) / MAP_PAGE;
+    void *newptr;
+    char *p;
+
+    if (size < MMAP_THRESHOLD)
+    {
+        if ((newptr = mm_malloc(size)) == NULL) return NULL;
+        memcpy(newptr, ptr, size);
+        map_free(ptr);
+        return newptr;
+    }
+    if (pages == MAP_PAGES(ptr)) return ptr;
+    if ((p = mem_remap(MAP_BASE(ptr), pages * MAP_PAGE)) == (void *)-1) return NULL;
+    PUT(p + offset - DSIZE, pages);
+    return p + offset;
+}
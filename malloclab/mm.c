@@ -16,22 +16,33 @@
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#ifdef MM_THREADS
+#include <pthread.h>
+#endif
 
 #include "mm.h"
 #include "memlib.h"
+#include "config.h"
 
-/* double word (8) alignment */
-#define ALIGNMENT 8
+/* ALIGNMENT comes from config.h: 8 bytes for the 32-bit build, 16 bytes (the x86-64 ABI) for the 64-bit build */
 
 /* rounds up to the nearest multiple of ALIGNMENT */
-#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~0x7)
+#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~(size_t)(ALIGNMENT-1))
 
 // Sizes
-#define WSIZE 4 // word size
+#define WSIZE 4 // word size (header and footer)
 #define DSIZE 8 // double word size
-#define MSIZE 16 // minimum free block size = 24
-#define MPAYLOAD 8 // minimum payload size
-#define CHUNKSIZE 1 << 6 // default size for expanding the heap
+#if defined(__LP64__) && !defined(FULL_LINKS)
+#define LSIZE WSIZE // free list links are 32-bit heap offsets (see SUCC), so MSIZE stays 16B
+#else
+#define LSIZE (sizeof(void *)) // free list link size
+#endif
+#define MSIZE ALIGN(DSIZE + 2*LSIZE) // minimum free block size: header, two links and footer
+#define MAX_REQUEST ((size_t)0xFFFFFFFF - 2*ALIGNMENT) // block sizes must fit in a header word
+#define MPAYLOAD (MSIZE - WSIZE) // minimum payload size
+#define CHUNKSIZE 1 << 6 // smallest size for expanding the heap
+#define CHUNK_SHIFT 5 // a larger arena grows by 1/2^CHUNK_SHIFT of its size at least (see extend_heap),
+#define CHUNK_MAX (1 << 12) // up to this many bytes
 
 // MACROs for mm.c
 #define MAX(x, y) ((x) > (y)? (x) : (y))
@@ -41,64 +52,357 @@
 
 #define GET(p)       (*(unsigned int *)(p))
 #define PUT(p, val)  (*(unsigned int *)(p) = (val))
-#define SET(p, bp)   (*(unsigned int *)(p) = (unsigned int)(bp))
+#if defined(__LP64__) && !defined(FULL_LINKS)
+// a link holds (bp - heap_listp) / ALIGNMENT, so 32 bits cover a 64GB heap. 0 is NULL, as no block starts at heap_listp.
+// SET evaluates bp twice, so pass it a variable.
+#define SET(p, bp)   PUT(p, (bp) ? (unsigned int)(((char *)(bp) - heap_listp) / ALIGNMENT) : 0)
+#define LINK(p)      (GET(p) ? heap_listp + (size_t)GET(p) * ALIGNMENT : NULL)
+#else
+#define SET(p, bp)   (*(char **)(p) = (char *)(bp))
+#define LINK(p)      (*(char **)(p))
+#endif
 
 #define GET_SIZE(p)  (GET(p) & ~0x7)
+#define HSIZE(bp)    (ATOMIC_GET((unsigned int *)HDRP(bp)) & ~0x7) // size in the header of an allocated block, from any thread
 #define GET_ALLOC(p) (GET(p) & 0x1)
 
+// bit 1 of a header tells whether the previous block is allocated, so only free blocks need a footer.
+#define PREV_ALLOC 0x2
+#define GET_PREV_ALLOC(p) (GET(p) & PREV_ALLOC)
+// the header of an allocated block may be read by a thread of another arena (HSIZE) while its owner flips this
+// bit, so the flip is atomic in the threaded build (ATOMIC_OR/AND, defined with the arena macros).
+#define SET_PREV_ALLOC(p) ATOMIC_OR((unsigned int *)(p), PREV_ALLOC)
+#define CLR_PREV_ALLOC(p) ATOMIC_AND((unsigned int *)(p), ~PREV_ALLOC)
+
+// bit 2 of an allocated block's header: realloc has grown it before. the next grow reserves 1/2^GROW_SHIFT more.
+#define GROWN 0x4
+#define GROW_SHIFT 3
+#define GET_GROWN(p) (GET(p) & GROWN)
+#define SET_GROWN(p) PUT(p, GET(p) | GROWN)
+#define CLR_GROWN(p) PUT(p, GET(p) & ~GROWN)
+// the same bit marks a free block whose inner pages were given back with mem_decommit. a size leaves only three low
+// bits, so the two share one: GROWN is only set on allocated headers and RELEASED only on free ones, and every
+// change between the two (free_block, place, carve, realloc) writes a new header that drops the bit.
+#define RELEASED GROWN
+#define GET_RELEASED(p) (GET(p) & RELEASED)
+#define SET_RELEASED(p) PUT(p, GET(p) | RELEASED)
+
 #define HDRP(bp)        ((char *)(bp) - WSIZE)
-#define FTRP(bp)        ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
+#define FTRP(bp)        ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE) // free blocks only
 
-#define PP(bp)        ((char *)(bp) + WSIZE)
+#define PP(bp)        ((char *)(bp) + LSIZE)
 #define SP(bp)        ((char *)(bp))
 
 #define NEXT_BLKP(bp)   ((char *)(bp) + GET_SIZE(((char*)(bp) - WSIZE)))
-#define PREV_BLKP(bp)   ((char *)(bp) - GET_SIZE(((char*)(bp) - DSIZE)))
-#define SUCC(bp)   (*(char **)((char *)(bp))) 
-#define PRED(bp)   (*(char **)((char *)(bp) + WSIZE))
+#define PREV_BLKP(bp)   ((char *)(bp) - GET_SIZE(((char*)(bp) - DSIZE))) // only if the previous block is free
+#define SUCC(bp)   LINK(SP(bp)) 
+#define PRED(bp)   LINK(PP(bp))
+
+// seglists from TREE_INDEX up are treaps keyed on (size, address); the link words become child pointers.
+#define TREE_INDEX 8
+#define LEFT(bp)   SUCC(bp)
+#define RIGHT(bp)  PRED(bp)
+#define KEY_LESS(a, b)  ((GET_SIZE(HDRP(a)) < GET_SIZE(HDRP(b))) || \
+                         ((GET_SIZE(HDRP(a)) == GET_SIZE(HDRP(b))) && ((char *)(a) < (char *)(b))))
+
+// slab layer: requests up to SLAB_MAX bytes are served from page-sized runs of fixed-size slots without boundary tags.
+#define RUNSIZE (1 << 12) // size of a slab run block, which is also the alignment of its payload
+#define SLAB_MAX 64 // largest request served from a slab run
+#define SLAB_WARMUP 32 // runs are used only once this many tiny blocks have been live at the same time
+#define RUN_HDR (2*LSIZE + 4*WSIZE) // next run, prev run, slot size, free slots, total slots, first slot offset; then the free-slot bitmap
+#define RUN_BASE(p)     ((char *)((size_t)(p) & ~(size_t)(RUNSIZE - 1)))
+#define RUN_SLOT(run)   (*(unsigned int *)((char *)(run) + 2*LSIZE))
+#define RUN_FREE(run)   (*(unsigned int *)((char *)(run) + 2*LSIZE + WSIZE))
+#define RUN_NSLOTS(run) (*(unsigned int *)((char *)(run) + 2*LSIZE + 2*WSIZE))
+#define RUN_FIRST(run)  (*(unsigned int *)((char *)(run) + 2*LSIZE + 3*WSIZE))
+#define RUN_MAP(run)    ((unsigned int *)((char *)(run) + RUN_HDR)) // bit set = slot free
+#define SLAB_MAPSIZE (((MAX_HEAP / RUNSIZE) / 32 + 2) * WSIZE) // bytes of the frame map
+#define SLAB_END (RUN_BASE(mem_heap_lo()) + (MAX_HEAP / RUNSIZE) * RUNSIZE) // the map only covers the first heap segment
+
+/* 
+ * Requests of MMAP_THRESHOLD bytes or more get a region of their own from mem_map, outside the heap.
+ * The payload starts ALIGNMENT bytes (or the requested alignment, up to a page) into the region,
+ * the word before the header holds the page count, and the header says size 0, which no block in the heap has.
+ */
+#define MAP_PAGE (1 << 12)
+#define PAGE_UP(p)   ((char *)(((size_t)(p) + MAP_PAGE - 1) & ~(size_t)(MAP_PAGE - 1)))
+#define PAGE_DOWN(p) ((char *)((size_t)(p) & ~(size_t)(MAP_PAGE - 1)))
+#define MAP_PAGES(bp) GET((char *)(bp) - DSIZE)
+#define MAP_BASE(bp)  PAGE_DOWN((char *)(bp) - DSIZE) // start of the region
+#define IS_MAPPED(bp) (HSIZE(bp) == 0) // slab objects have no header, so only after slab_test
+
+// quick-lists: a freed block of up to QUICK_MAX bytes stays allocated in an exact-size LIFO, linked through SP,
+// so the next request of that size skips the seglists, the boundary tags and coalescing.
+// slot QUICK_INDEX(size) holds one size at a time, taken by the first block freed into it while it is empty.
+// the blocks are freed for real when their list passes QUICK_LIMIT, or when find_fit misses (see quick_sweep).
+#define NQUICK 16
+#define QUICK_MAX (1 << 13)
+#define QUICK_LIMIT 32
+#define QUICK_INDEX(size) ((int)(((size) / ALIGNMENT) % NQUICK))
+
+// fit policies of find_fit, picked by mm_init from the MM_FIT environment variable (see fit_setup):
+//   best  - the smallest block that fits, the default. the seglists are sorted by size, so this is the first fit
+//           in the request's class, or the smallest block of the next non-empty class.
+//   first - the first block that fits in list order. freed blocks go to the head of their list, unsorted.
+//   next  - first fit, but the walk of the request's class starts at the rover (the block after the last one taken)
+//           and wraps around. the treaps are searched first fit.
+//   good[:K[:X]] - best fit that settles for the first block at most X% over the request, and stops looking after
+//           K blocks. (good = good:8:25)
+#define FIT_BEST 0
+#define FIT_FIRST 1
+#define FIT_NEXT 2
+#define FIT_GOOD 3
+#define FIT_SORTED ((fit_policy == FIT_BEST) || (fit_policy == FIT_GOOD)) // whether add_node keeps the lists sorted
+
+// lifetime predictor, on when MM_LIFETIME=1 at mm_init. requests are keyed by block size and the caller's site hint
+// (mm_malloc_site). the arena clock (AR_TICK) counts allocations, and a table keyed by address samples the birth
+// time and key of recent blocks. when a sampled block is freed, or pushed out of the table while already old, its
+// key learns whether the block lived less than MM_SHORT_LIVED allocations. a key that mostly saw short lives predicts
+// short-lived blocks: those are placed at the top of the heap and at the rear of free blocks, the others at the front,
+// so the long-lived blocks pack together low in the heap instead of being stranded between short-lived ones.
+#define LIFE_KEYS 64
+#define LIFE_SAMPLES 128
+#define LIFE_HEAP (1 << 16) // the table costs about 2KB, so a smaller heap does without
+#define LIFE_LEARN 32 // a key halves its counts when they reach this, so it follows a change of behaviour
+#define LIFE_KEY(size, site) (((unsigned int)((size) / ALIGNMENT) * 0x9e3779b1u + (unsigned int)(site) * 0x85ebca6bu) >> 26)
+#define LIFE_SLOT(p)         (((unsigned int)((size_t)(p) / ALIGNMENT) * 0x9e3779b1u) >> 25)
+#define LIFE_PTR(t, i)    (((void **)(t))[i]) // sampled block, or NULL
+#define LIFE_BIRTH(t, i)  (((unsigned int *)((void **)(t) + LIFE_SAMPLES))[i])
+#define LIFE_KEYOF(t, i)  (((unsigned int *)((void **)(t) + LIFE_SAMPLES))[LIFE_SAMPLES + (i)])
+#define LIFE_SHORTS(t, k) (((unsigned int *)((void **)(t) + LIFE_SAMPLES))[2*LIFE_SAMPLES + (k)])
+#define LIFE_LONGS(t, k)  (((unsigned int *)((void **)(t) + LIFE_SAMPLES))[2*LIFE_SAMPLES + LIFE_KEYS + (k)])
+#define LIFE_SIZE (LIFE_SAMPLES*sizeof(void *) + (2*LIFE_SAMPLES + 2*LIFE_KEYS)*WSIZE)
+
+#ifdef MM_BUDDY
+#ifdef MM_THREADS
+#error "MM_BUDDY works with the single arena only"
+#endif
+// buddy engine: requests of BUDDY_MIN bytes up to BUDDY_CHUNK are served from page-aligned BUDDY_CHUNK-byte chunks of
+// the heap, split into power-of-two blocks without boundary tags. a block of order k is BUDDY_MIN << k bytes and its
+// offset in the chunk is a multiple of that, so its buddy is the block whose offset differs from its own in that one bit.
+// each chunk is followed by its metadata: the order of every block on the byte of its first page, then one free bitmap
+// per order. free blocks of order k are also on the arena list AR_BUDDY(ar, k), linked through their first two pointers.
+// buddy_map holds one entry per heap page: 1 + the page index of the first page of its chunk, or 0 outside any chunk.
+// the engine starts once BUDDY_WARMUP bytes of medium requests are live in normal blocks, so a heap with only a few
+// of them does not pay for a chunk, and it takes only the requests that waste less than 1/2^BUDDY_SLACK of their block.
+#define NBUDDY 9
+#define BUDDY_MIN MAP_PAGE
+#define BUDDY_TOP (NBUDDY - 1)
+#define BUDDY_CHUNK (BUDDY_MIN << BUDDY_TOP)
+#define BUDDY_PAGES (BUDDY_CHUNK / BUDDY_MIN)
+#define BUDDY_META (BUDDY_PAGES + (2*BUDDY_PAGES / 32) * WSIZE)
+#define BUDDY_FITS(size) (((size) >= BUDDY_MIN) && ((size) <= BUDDY_CHUNK))
+#define BUDDY_WARMUP BUDDY_CHUNK
+#define BUDDY_SLACK 3
+#define BUDDY_PAGE(p)      ((size_t)((char *)(p) - PAGE_DOWN(mem_heap_lo())) / BUDDY_MIN) // page index in the first segment
+#define BUDDY_BASE(p)      (PAGE_DOWN(mem_heap_lo()) + (size_t)(buddy_map[BUDDY_PAGE(p)] - 1) * BUDDY_MIN)
+#define BUDDY_ORDER(c, p)  (((unsigned char *)(c) + BUDDY_CHUNK)[((char *)(p) - (char *)(c)) / BUDDY_MIN])
+#define BUDDY_BITS(c)      ((unsigned int *)((char *)(c) + BUDDY_CHUNK + BUDDY_PAGES))
+#define BUDDY_BIT(c, p, k) ((2*BUDDY_PAGES - (2*BUDDY_PAGES >> (k))) + ((char *)(p) - (char *)(c)) / (BUDDY_MIN << (k)))
+#define BUDDY_NEXT(bp)     (((void **)(bp))[0])
+#define BUDDY_PREV(bp)     (((void **)(bp))[1])
+#define BUDDY_MAPSIZE ((MAX_HEAP / BUDDY_MIN + 2) * WSIZE) // bytes of the page map
+#define BUDDY_GONE(size) do { if (!buddy_on && BUDDY_FITS(size)) buddy_live -= MIN(buddy_live, (size_t)(size)); } while (0)
+#else
+#define NBUDDY 0
+#define BUDDY_FITS(size) 0
+#define buddy_test(ptr) 0
+#define buddy_alloc(size) NULL
+#define buddy_free(ptr)
+#define BUDDY_GONE(size)
+#define buddy_size(ptr) 0
+#endif
+
+// arena header: the allocator state lives in the heap, at the start of each arena's first region.
+// segregated free lists: AR_LIST(ar, k) is the k-th seglist. 
+//   for k = 0~7, 32B interval: 1~31, 32~63, ..., 224~255
+//   for k = 8~23, power of 2 interval (256B ~, 512B ~, 1KB ~, ..., 8MB ~ inf), kept as a treap (see TREE_INDEX)
+// AR_SLAB(ar, i) holds the slab runs with at least one free slot for slot size ALIGNMENT*(i+1).
+#define NLISTS 24
+#define AR_PTRS (NLISTS + 8 + 4 + NQUICK + NBUDDY + 4)
+#define AR_WORDS (7 + 2*NQUICK)
+#define AR_LIST(ar, i)    (((void **)(ar))[i])
+#define AR_SLAB(ar, i)    (((void **)(ar))[NLISTS + (i)])
+#define AR_BRK(ar)        (((char **)(ar))[NLISTS + 8])     // first byte after the epilogue of the current region
+#define AR_LIMIT(ar)      (((char **)(ar))[NLISTS + 8 + 1]) // end of the current region (threaded mode)
+#define AR_REMOTE(ar)     (((void **)(ar))[NLISTS + 8 + 2]) // blocks freed by other threads, pushed without the lock (threaded mode)
+#define AR_FRESH(ar)      (((char **)(ar))[NLISTS + 8 + 3]) // no payload at or above it has been handed out yet (see MARK_DIRTY)
+#define AR_QUICK(ar, i)   (((void **)(ar))[NLISTS + 8 + 4 + (i)]) // quick-list heads
+#define AR_BUDDY(ar, k)   (((void **)(ar))[NLISTS + 8 + 4 + NQUICK + (k)]) // free buddy blocks of order k (MM_BUDDY)
+#define AR_ROVER(ar)      (((void **)(ar))[NLISTS + 8 + 4 + NQUICK + NBUDDY]) // where the next fit search starts, or NULL
+#define AR_LIFE(ar)       (((char **)(ar))[NLISTS + 8 + 4 + NQUICK + NBUDDY + 1]) // lifetime predictor table, or NULL
+#define AR_WILD(ar)       (((char **)(ar))[NLISTS + 8 + 4 + NQUICK + NBUDDY + 2]) // free block just below AR_BRK, kept out of the seglists, or NULL
+#define AR_HEAP(ar)       (((size_t *)(ar))[NLISTS + 8 + 4 + NQUICK + NBUDDY + 3]) // bytes the arena took with arena_sbrk and still holds
+#define AR_WORD(ar, k)    (((unsigned int *)((void **)(ar) + AR_PTRS))[k])
+#define AR_BITMAP(ar)     AR_WORD(ar, 0) // bit k is set iff seglist k is non-empty
+#define AR_SMALL_LIVE(ar) AR_WORD(ar, 1) // tiny requests currently held in normal blocks, until the slab layer is switched on
+#define AR_SLAB_ON(ar)    AR_WORD(ar, 2)
+#define AR_INDEX(ar)      AR_WORD(ar, 3) // position in the arena table (threaded mode)
+#define AR_QTOTAL(ar)     AR_WORD(ar, 4) // blocks in all quick-lists
+#define AR_QSIZE(ar, i)   AR_WORD(ar, 5 + (i)) // block size held by quick-list i
+#define AR_QCOUNT(ar, i)  AR_WORD(ar, 5 + NQUICK + (i))
+#define AR_TICK(ar)       AR_WORD(ar, 5 + 2*NQUICK) // allocations so far, the clock of the lifetime predictor
+#define AR_SITE(ar)       AR_WORD(ar, 6 + 2*NQUICK) // site hint of the request being served (mm_malloc_site)
+// the heap above AR_FRESH is zero, apart from the tags and links of the free blocks there, so mm_calloc
+// need not clear it. everything that hands out a block, or leaves tags or links behind, moves the mark past them.
+#define MARK_DIRTY(p) do { if ((char *)(p) > AR_FRESH(arena)) AR_FRESH(arena) = (char *)(p); } while (0)
+#ifdef MM_THREADS
+#define AR_LOCK(ar)       ((pthread_mutex_t *)((char *)(ar) + ALIGN(AR_PTRS*sizeof(void *) + AR_WORDS*WSIZE)))
+#define AR_SIZE           ALIGN(AR_PTRS*sizeof(void *) + AR_WORDS*WSIZE + sizeof(pthread_mutex_t))
+#else
+#define AR_SIZE           ALIGN(AR_PTRS*sizeof(void *) + AR_WORDS*WSIZE)
+#endif
+
+#ifdef MM_THREADS
+// threaded mode: MM_ARENAS arenas, each growing by regions that start on a CHUNK frame of the simulated heap. the
+// region at the top of the heap grows in place as its arena needs it, so a single arena uses the heap as tightly as
+// the plain build; only when another arena takes the next frame is the rest of the top frame left unused.
+// the root at the start of the heap holds the heap lock, the arena table and one byte per frame naming its arena.
+#define MM_ARENAS 8
+#define CHUNK (1 << 20)
+#define ROOT_LOCK         ((pthread_mutex_t *)heap_listp)
+#define ROOT_ARENA(i)     (((char **)(heap_listp + ALIGN(sizeof(pthread_mutex_t))))[i])
+#define ROOT_FRAME(p)     (((unsigned char *)&ROOT_ARENA(MM_ARENAS))[((char *)(p) - heap_listp) / CHUNK])
+#define ROOT_MAP          ((unsigned int *)(heap_listp + ALIGN(ALIGN(sizeof(pthread_mutex_t)) + MM_ARENAS*sizeof(char *) + MAX_HEAP/CHUNK + 1)))
+#define ROOT_SIZE         ALIGN((char *)ROOT_MAP - heap_listp + SLAB_MAPSIZE) // the slab frame map lives in the root too
+#define OWNER(p)          ROOT_ARENA(ROOT_FRAME(p))
+#define FRAME_UP(p)       (heap_listp + (((char *)(p) - heap_listp + CHUNK - 1) / CHUNK) * CHUNK)
+#define LOCK(ar)          pthread_mutex_lock(AR_LOCK(ar))
+#define UNLOCK(ar)        pthread_mutex_unlock(AR_LOCK(ar))
+#define ATOMIC_OR(p, v)   __atomic_fetch_or(p, v, __ATOMIC_RELAXED)
+#define ATOMIC_AND(p, v)  __atomic_fetch_and(p, v, __ATOMIC_RELAXED)
+#define ATOMIC_GET(p)     __atomic_load_n(p, __ATOMIC_RELAXED)
+#define MAP_LOCK()        pthread_mutex_lock(ROOT_LOCK) // memlib is not thread-safe
+#define MAP_UNLOCK()      pthread_mutex_unlock(ROOT_LOCK)
+
+// per-thread cache of freed blocks: requests up to TC_MAX bytes, one LIFO per TC_STEP class, linked through the payload.
+// only a miss (refill TC_REFILL blocks) or an overflow (flush half of TC_LIMIT blocks) takes an arena lock.
+#define TC_STEP 16
+#define TC_CLASSES 16
+#define TC_MAX (TC_STEP * TC_CLASSES)
+#define TC_LIMIT 32
+#define TC_REFILL 8
+#define TC_HEAD(tc, i)    (((void **)(tc))[i])
+#define TC_COUNT(tc, i)   (((unsigned int *)((void **)(tc) + TC_CLASSES))[i])
+#define TC_SIZE           (TC_CLASSES * (sizeof(void *) + WSIZE))
+#define TC_NEXT(bp)       (*(void **)(bp)) // also links the remote free lists
+#else
+#define ATOMIC_OR(p, v)   (*(p) |= (v))
+#define ATOMIC_AND(p, v)  (*(p) &= (v))
+#define ATOMIC_GET(p)     (*(p))
+#define MAP_LOCK()
+#define MAP_UNLOCK()
+#endif
 
 // global variables
-static char *heap_listp = 0; // pointer to the 1st block
-
-// segregated free lists: seglistk means k-th seglist. 
-// for k = 0~7, 32B interval
-static void *seglist0; // 1~31
-static void *seglist1; // 32~63
-static void *seglist2; // 64~95
-static void *seglist3; // 96~127
-static void *seglist4; // 128~159
-static void *seglist5; // 160~191
-static void *seglist6; // 192~223
-static void *seglist7; // 224~255
-// for k = 8~24, power of 2 interval
-static void *seglist8; // 256B ~
-static void *seglist9; // 512B ~
-static void *seglist10; // 1KB ~
-static void *seglist11; // 2KB ~
-static void *seglist12; // 4KB ~
-static void *seglist13; 
-static void *seglist14;
-static void *seglist15;
-static void *seglist16;
-static void *seglist17;
-static void *seglist18;
-static void *seglist19;
-static void *seglist20; // 1MB ~
-static void *seglist21;
-static void *seglist22;
-static void *seglist23; // 8MB ~ inf
+static char *heap_listp = 0; // start of the heap, also the base of 32-bit links
+#ifdef MM_THREADS
+static __thread char *arena; // arena being worked on; its lock is held
+static __thread char *home; // arena this thread allocates from
+static __thread char *tcache; // this thread's cache
+static __thread unsigned int thread_gen; // heap generation home and tcache belong to
+static unsigned int heap_gen; // bumped by mm_init, so threads drop state from an old heap
+static unsigned int next_arena; // round robin counter for assigning arenas to threads
+static pthread_key_t tc_key; // runs thread_exit when a thread with a cache exits
+static int tc_key_made;
+#else
+static char *arena; // the only arena, at the start of the heap
+#endif
+
+// one bit per RUNSIZE frame of the heap, set iff the frame is a slab run. allocated with the first run.
+static unsigned int *slab_map;
+static char *slab_lo; // lowest and highest address ever covered by a run,
+static char *slab_hi; // so most non-slab frees skip the map lookup.
+static int fit_policy = FIT_BEST; // set by mm_init, the same for all arenas
+static int fit_probes; // good fit: blocks looked at before taking the best so far
+static int fit_slack; // good fit: percent over the request that is close enough
+static int life_on; // MM_LIFETIME: each arena gets a predictor table with its first allocation
+#ifdef MM_BUDDY
+// one word per page of the first heap segment: 1 + the page index of the chunk holding it, or 0 if it is in none.
+// allocated with the first chunk.
+static unsigned int *buddy_map;
+static size_t buddy_live; // medium request bytes live in normal blocks, until the engine is switched on
+static int buddy_on;
+static char *buddy_lo; // lowest and highest address ever covered by a chunk
+static char *buddy_hi;
+#endif
 
 // helper functions
+static void *arena_malloc(size_t size);
+static void arena_free(void *ptr);
+static void *arena_realloc(void *ptr, size_t size);
+static char *arena_new(char *p, char *limit, int index);
+static char *arena_sbrk(size_t incr);
+static char *region_init(char *p);
+#ifdef MM_THREADS
+static char *frame_sbrk(size_t len);
+static void thread_init(void);
+static void thread_exit(void *tc);
+static void tcache_fill(int c);
+static void tcache_flush(int c, int keep);
+static void arena_give(char *owner, void *first, void *last);
+static void remote_drain(void);
+#endif
+static void free_block(void *bp);
+static int quick_sweep(int q);
+static void trim_heap(void *bp);
 static void *extend_heap(size_t size);
+static void *wild_fit(size_t adjsize);
 static void *realloc_place(void *bp, size_t adjsize);
-static void *place(void *bp, size_t adjsize);
+static void *place(void *bp, size_t adjsize, int rear);
+static void place_batch(void *bp, size_t adjsize, int n, void **out);
 static void *find_fit(size_t adjsize);
+static void fit_setup(void);
+static void *first_fit(size_t adjsize);
+static void *next_fit(size_t adjsize);
+static void *good_fit(size_t adjsize);
+static int larger_class(int i);
+static void life_init(void);
+static int life_predict(unsigned int key);
+static void life_born(void *bp, unsigned int key);
+static void life_died(void *ptr);
+static void life_learn(unsigned int key, int short_lived);
 static void *coalesce(void *bp);
+static void release_pages(void *bp, char *lo, char *hi);
 static void remove_node(void *bp);
 static void add_node(void *bp);
 static int find_index(size_t size);
 static void seglist_init(void);
 static void **find_list(int i);
+static void *slab_alloc(size_t size);
+static void slab_free(void *ptr);
+static int slab_test(void *ptr);
+static void *slab_new_run(size_t slot);
+#ifdef MM_BUDDY
+static void *buddy_alloc(size_t size);
+static void buddy_free(void *ptr);
+static int buddy_test(void *ptr);
+static size_t buddy_size(void *ptr);
+static void *buddy_new_chunk(void);
+static void buddy_link(char *bp, int k);
+static void buddy_unlink(char *bp, int k);
+#endif
+static void *aligned_block(size_t align, size_t adjsize);
+static void *carve(void *bp, size_t align, size_t adjsize);
+static void *arena_memalign(size_t align, size_t size);
+static void *arena_calloc(size_t size);
+#ifndef MM_THREADS
+static void arena_free_sized(void *ptr, size_t size);
+#endif
+static int quick_push(void *ptr, size_t size);
+static int arena_malloc_batch(size_t size, int n, void **out);
+static void arena_free_batch(void **ptrs, int n);
+static int arena_lifetime(size_t size, int site);
+static int ptr_cmp(const void *a, const void *b);
+static void **find_slab(int i);
+static void *map_alloc(size_t size, size_t align);
+static void map_free(void *ptr);
+static void *map_realloc(void *ptr, size_t size);
+static void *tree_insert(void *root, void *bp);
+static void *tree_remove(void *root, void *bp);
+static void *tree_merge(void *a, void *b);
+static void *tree_best_fit(void *root, size_t adjsize);
+static unsigned int tree_prio(void *bp);
 
 /*
  * mm_init - creates a heap with an intial free block
@@ -106,15 +410,33 @@ static void **find_list(int i);
 int mm_init(void)
 {
     //printf("\n Entering Init: \n");
-    // intialize the list first. 
-    seglist_init();
-
-    /* create a free block. sbrk returns the pointer to the original top of the heap */
-    if ((heap_listp = mem_sbrk(2*DSIZE)) == (void *)-1) return -1;
-    PUT(heap_listp, 0);                             /* Alignment Padding */
-    PUT(heap_listp + (1*WSIZE), PACK(DSIZE, 1));    /* Prologue header */
-    PUT(heap_listp + (2*WSIZE), PACK(DSIZE, 1));    /* Prologue footer */
-    PUT(heap_listp + (3*WSIZE), PACK(0, 1));        /* Epilogue header */
+    slab_map = NULL;
+    slab_lo = slab_hi = NULL;
+    fit_setup();
+    life_on = (getenv("MM_LIFETIME") != NULL) && (atoi(getenv("MM_LIFETIME")) > 0);
+#ifdef MM_BUDDY
+    buddy_map = NULL;
+    buddy_lo = buddy_hi = NULL;
+    buddy_live = 0;
+    buddy_on = 0;
+#endif
+#ifdef MM_THREADS
+    // the root takes the start of the first frame, and arena 0 the rest of it.
+    if ((heap_listp = mem_sbrk(ROOT_SIZE + AR_SIZE + 2*ALIGNMENT)) == (void *)-1) return -1;
+    memset(heap_listp, 0, ROOT_SIZE);
+    pthread_mutex_init(ROOT_LOCK, NULL);
+    slab_map = ROOT_MAP; // every run is in the map, so there is no range to check first
+    slab_lo = heap_listp;
+    slab_hi = heap_listp + MAX_HEAP;
+    if (!tc_key_made) tc_key_made = (pthread_key_create(&tc_key, thread_exit) == 0);
+    heap_gen++; // threads drop their arena and cache from the previous heap
+    next_arena = 0;
+    ROOT_ARENA(0) = arena_new(heap_listp + ROOT_SIZE, heap_listp + ROOT_SIZE + AR_SIZE + 2*ALIGNMENT, 0);
+#else
+    // the arena header comes first. the prologue payload and every block after it start on an ALIGNMENT boundary.
+    if ((heap_listp = mem_sbrk(AR_SIZE + 2*ALIGNMENT)) == (void *)-1) return -1;
+    arena_new(heap_listp, NULL, 0);
+#endif
 
     /* Extend the empty heap with a free block of CHUNKSIZE bytes */
     //printf("Init: extending the heap.\n");
@@ -122,54 +444,729 @@ int mm_init(void)
     return 0;
 }
 
+#ifdef MM_THREADS
+/*
+ * mm_malloc - Allocate from the thread's cache, or from its home arena under the arena lock
+ */
+void *mm_malloc(size_t size)
+{
+    void *bp;
+    int c;
+
+    if (heap_listp == 0) mm_init(); // initialize the heap by calling mm_init
+    if ((size == 0) || (size > MAX_REQUEST)) return NULL;
+    thread_init();
+    if ((tcache != NULL) && (size <= TC_MAX))
+    {
+        c = (int)((size - 1) / TC_STEP);
+        if (TC_HEAD(tcache, c) == NULL) tcache_fill(c);
+        if ((bp = TC_HEAD(tcache, c)) == NULL) return NULL;
+        TC_HEAD(tcache, c) = TC_NEXT(bp);
+        TC_COUNT(tcache, c)--;
+        return bp;
+    }
+    LOCK(home);
+    arena = home;
+    remote_drain();
+    bp = arena_malloc(size);
+    UNLOCK(home);
+    return bp;
+}
+
+/*
+ * mm_free - Keep the block in the thread's cache, or give it back to the arena it came from
+ */
+void mm_free(void *ptr)
+{
+    size_t usable;
+    int c;
+
+    if (ptr == 0) return;
+    if (!slab_test(ptr) && IS_MAPPED(ptr)) // not in any arena
+    {
+        map_free(ptr);
+        return;
+    }
+    thread_init();
+    if (tcache != NULL)
+    {
+        // the size bits of an allocated block do not change and the owner flips PREV_ALLOC atomically, so no lock is needed.
+        usable = slab_test(ptr) ? RUN_SLOT(RUN_BASE(ptr)) : HSIZE(ptr) - WSIZE;
+        if ((usable >= TC_STEP) && (usable < TC_MAX + TC_STEP)) // serves requests up to (c+1)*TC_STEP bytes
+        {
+            c = (int)(usable / TC_STEP) - 1;
+            TC_NEXT(ptr) = TC_HEAD(tcache, c);
+            TC_HEAD(tcache, c) = ptr;
+            if (++TC_COUNT(tcache, c) >= TC_LIMIT) tcache_flush(c, TC_LIMIT / 2);
+            return;
+        }
+    }
+    TC_NEXT(ptr) = NULL;
+    arena_give(OWNER(ptr), ptr, ptr);
+}
+
+/*
+ * mm_realloc - Resize the block in the arena it came from
+ */
+void *mm_realloc(void *ptr, size_t size)
+{
+    char *owner;
+    void *newptr;
+
+    if (size == 0) 
+    {
+        mm_free(ptr);
+        return NULL;
+    }
+    if (ptr == NULL) return mm_malloc(size);
+    if (!slab_test(ptr) && IS_MAPPED(ptr)) return map_realloc(ptr, size);
+    owner = OWNER(ptr);
+    LOCK(owner);
+    arena = owner;
+    newptr = arena_realloc(ptr, size);
+    UNLOCK(owner);
+    return newptr;
+}
+
+/*
+ * mm_memalign - Allocate a block whose payload is a multiple of alignment, from the home arena
+ */
+void *mm_memalign(size_t alignment, size_t size)
+{
+    void *bp;
+
+    if ((alignment == 0) || (alignment & (alignment - 1))) return NULL; // must be a power of two
+    if (alignment <= ALIGNMENT) return mm_malloc(size);
+    if (heap_listp == 0) mm_init();
+    thread_init();
+    LOCK(home);
+    arena = home;
+    remote_drain();
+    bp = arena_memalign(alignment, size);
+    UNLOCK(home);
+    return bp;
+}
+
+/*
+ * mm_calloc - Allocate a zeroed array from the home arena; small ones skip the cache, which cannot tell fresh memory
+ */
+void *mm_calloc(size_t nmemb, size_t size)
+{
+    void *bp;
+
+    if ((nmemb != 0) && (size > MAX_REQUEST / nmemb)) return NULL; // nmemb * size would overflow or be too large
+    if (heap_listp == 0) mm_init();
+    thread_init();
+    LOCK(home);
+    arena = home;
+    remote_drain();
+    bp = arena_calloc(nmemb * size);
+    UNLOCK(home);
+    return bp;
+}
+
+/*
+ * mm_free_sized - Free a block that was allocated with a payload of size bytes; a small one goes to the
+ * cache class the size picks, without reading its header or run
+ */
+void mm_free_sized(void *ptr, size_t size)
+{
+    int c;
+
+    if (ptr == 0) return;
+#ifdef MM_DEBUG
+    assert(size <= mm_usable_size(ptr)); // the size picks the cache class, so it must not be too large
+#endif
+    thread_init();
+    if ((tcache == NULL) || (size < TC_STEP) || (size >= TC_MAX + TC_STEP))
+    {
+        mm_free(ptr);
+        return;
+    }
+    c = (int)(size / TC_STEP) - 1; // like mm_free, with the size standing in for the usable size
+    TC_NEXT(ptr) = TC_HEAD(tcache, c);
+    TC_HEAD(tcache, c) = ptr;
+    if (++TC_COUNT(tcache, c) >= TC_LIMIT) tcache_flush(c, TC_LIMIT / 2);
+}
+
+/*
+ * mm_malloc_batch - Allocate n blocks of size bytes from the home arena under one lock; returns how many it got
+ */
+int mm_malloc_batch(size_t size, int n, void **out)
+{
+    int k;
+
+    if (heap_listp == 0) mm_init();
+    thread_init();
+    LOCK(home);
+    arena = home;
+    remote_drain();
+    k = arena_malloc_batch(size, n, out);
+    UNLOCK(home);
+    return k;
+}
+
+/*
+ * mm_free_batch - Free n blocks. ptrs is sorted by address, so the blocks of one arena come in groups:
+ * the home arena frees its group under one lock, and any other arena gets its group as one remote chain.
+ */
+void mm_free_batch(void **ptrs, int n)
+{
+    char *owner;
+    int i, j, k;
+
+    if (n <= 0) return;
+    thread_init();
+    qsort(ptrs, n, sizeof(void *), ptr_cmp);
+    for (i = 0; i < n; i = j)
+    {
+        j = i + 1;
+        if (ptrs[i] == NULL) continue;
+        if (!slab_test(ptrs[i]) && IS_MAPPED(ptrs[i]))
+        {
+            map_free(ptrs[i]);
+            continue;
+        }
+        owner = OWNER(ptrs[i]);
+        while ((j < n) && (slab_test(ptrs[j]) || !IS_MAPPED(ptrs[j])) && (OWNER(ptrs[j]) == owner)) j++;
+        if (owner == home)
+        {
+            LOCK(home);
+            arena = home;
+            remote_drain();
+            arena_free_batch(ptrs + i, j - i);
+            UNLOCK(home);
+            continue;
+        }
+        for (k = i; k < j - 1; k++) TC_NEXT(ptrs[k]) = ptrs[k + 1];
+        TC_NEXT(ptrs[j - 1]) = NULL;
+        arena_give(owner, ptrs[i], ptrs[j - 1]);
+    }
+}
+
+/*
+ * mm_malloc_site - mm_malloc with a hint naming the call site; small requests come from the cache, which ignores it
+ */
+void *mm_malloc_site(size_t size, int site)
+{
+    void *bp;
+
+    if (heap_listp == 0) mm_init();
+    thread_init();
+    if ((tcache != NULL) && (size <= TC_MAX)) return mm_malloc(size);
+    LOCK(home);
+    arena = home;
+    remote_drain();
+    AR_SITE(arena) = site;
+    bp = arena_malloc(size);
+    AR_SITE(arena) = 0;
+    UNLOCK(home);
+    return bp;
+}
+
 /*
- * mm_malloc - Allocate a block using implicit allocations
+ * mm_lifetime - Whether the home arena would place a block of size bytes from site as short-lived now, or -1
+ */
+int mm_lifetime(size_t size, int site)
+{
+    int r;
+
+    if (heap_listp == 0) mm_init();
+    thread_init();
+    LOCK(home);
+    arena = home;
+    r = arena_lifetime(size, site);
+    UNLOCK(home);
+    return r;
+}
+#else
+/*
+ * mm_malloc, mm_free, mm_realloc - the single arena is used directly
  */
 void *mm_malloc(size_t size)
+{
+    if (heap_listp == 0) mm_init(); // initialize the heap by calling mm_init
+    return arena_malloc(size);
+}
+
+void mm_free(void *ptr)
+{
+    arena_free(ptr);
+}
+
+void *mm_realloc(void *ptr, size_t size)
+{
+    return arena_realloc(ptr, size);
+}
+
+/*
+ * mm_memalign - Allocate a block whose payload is a multiple of alignment (a power of two)
+ */
+void *mm_memalign(size_t alignment, size_t size)
+{
+    if ((alignment == 0) || (alignment & (alignment - 1))) return NULL; // must be a power of two
+    if (alignment <= ALIGNMENT) return mm_malloc(size); // every block is aligned this much
+    if (heap_listp == 0) mm_init();
+    return arena_memalign(alignment, size);
+}
+
+/*
+ * mm_calloc - Allocate a zeroed array of nmemb elements of size bytes
+ */
+void *mm_calloc(size_t nmemb, size_t size)
+{
+    if ((nmemb != 0) && (size > MAX_REQUEST / nmemb)) return NULL; // nmemb * size would overflow or be too large
+    if (heap_listp == 0) mm_init();
+    return arena_calloc(nmemb * size);
+}
+
+/*
+ * mm_free_sized - Free a block that was allocated with a payload of size bytes (or realloc'ed to it)
+ */
+void mm_free_sized(void *ptr, size_t size)
+{
+    if (ptr == 0) return;
+#ifdef MM_DEBUG
+    assert(size <= mm_usable_size(ptr)); // the size picks the quick-list, so it must not be too large
+#endif
+    arena_free_sized(ptr, size);
+}
+
+/*
+ * mm_malloc_batch - Allocate n blocks of size bytes into out; returns how many it got
+ */
+int mm_malloc_batch(size_t size, int n, void **out)
+{
+    if (heap_listp == 0) mm_init();
+    return arena_malloc_batch(size, n, out);
+}
+
+/*
+ * mm_free_batch - Free n blocks; ptrs is sorted by address on the way
+ */
+void mm_free_batch(void **ptrs, int n)
+{
+    if (n <= 0) return;
+    qsort(ptrs, n, sizeof(void *), ptr_cmp);
+    arena_free_batch(ptrs, n);
+}
+
+/*
+ * mm_malloc_site - mm_malloc with a hint naming the call site, which the lifetime predictor keys on with the size
+ */
+void *mm_malloc_site(size_t size, int site)
+{
+    void *bp;
+
+    if (heap_listp == 0) mm_init();
+    AR_SITE(arena) = site;
+    bp = arena_malloc(size);
+    AR_SITE(arena) = 0;
+    return bp;
+}
+
+/*
+ * mm_lifetime - Whether a block of size bytes from site would be placed as short-lived now, or -1
+ */
+int mm_lifetime(size_t size, int site)
+{
+    if (heap_listp == 0) mm_init();
+    return arena_lifetime(size, site);
+}
+#endif
+
+/*
+ * mm_aligned_alloc - C11 aligned_alloc; like mm_memalign, and size need not be a multiple of alignment
+ */
+void *mm_aligned_alloc(size_t alignment, size_t size)
+{
+    return mm_memalign(alignment, size);
+}
+
+/*
+ * mm_usable_size - The number of bytes the caller may use at ptr, at least what it asked for
+ */
+size_t mm_usable_size(void *ptr)
+{
+    if (ptr == NULL) return 0;
+    if (slab_test(ptr)) return RUN_SLOT(RUN_BASE(ptr));
+    if (buddy_test(ptr)) return buddy_size(ptr);
+    if (IS_MAPPED(ptr)) return MAP_PAGES(ptr) * MAP_PAGE - ((char *)ptr - MAP_BASE(ptr));
+    return HSIZE(ptr) - WSIZE;
+}
+
+/*
+ * arena_malloc - Allocate a block in the current arena
+ */
+static void *arena_malloc(size_t size)
 {
     //printf("\n Entering Malloc: \n");
     //printf("Malloc: now allocating size (%d)\n", size);
     size_t adjsize;
     char *bp;
+    unsigned int key = 0;
+    int q, rear;
 
-    if (heap_listp == 0) mm_init(); // initialize the heap by calling mm_init
-    if (size == 0) return NULL; // ignore 0B requests
-    if (size <= MPAYLOAD) adjsize = MSIZE; // 8B is the minimum payload, and block is 16B total. 
-    else adjsize = ALIGN(DSIZE + size); // if larger than 8B, then just align the size + 8B. 
+    if ((size == 0) || (size > MAX_REQUEST)) return NULL; // ignore 0B requests and ones a header cannot describe
+    AR_TICK(arena)++; // the predictor's clock counts every allocation, wherever it is served from
+    if (size >= MMAP_THRESHOLD) return map_alloc(size, ALIGNMENT); // huge blocks stay out of the heap
+    if (BUDDY_FITS(size) && ((bp = buddy_alloc(size)) != NULL)) return bp; // page-sized ones go to the buddy engine if it is built in
+    if (size <= SLAB_MAX) // tiny requests go to a slab run, falling back to a normal block if no run can be made
+    {
+        // a few tiny blocks are cheaper in the heap than a whole run, so wait until there are many of them.
+        if (!AR_SLAB_ON(arena) && (++AR_SMALL_LIVE(arena) >= SLAB_WARMUP)) AR_SLAB_ON(arena) = 1;
+        if (AR_SLAB_ON(arena) && ((bp = slab_alloc(size)) != NULL)) return bp;
+    }
+    if (size <= MPAYLOAD) adjsize = MSIZE; // a block is MSIZE at least (16B with 4B links, 32B with 8B links). 
+    else adjsize = ALIGN(WSIZE + size); // if larger than 12B, then just align the size + header. 
     //printf("Malloc: adjusted size is %d\n", adjsize); 
+    // allocating at the rear side of the free block can inprove the utilization as coalescing is more likely.
+    rear = (adjsize >= 32);
+    if (life_on && (AR_LIFE(arena) == NULL) && ((AR_TICK(arena) & 63) == 0) && (AR_HEAP(arena) >= LIFE_HEAP)) life_init();
+    if (AR_LIFE(arena) != NULL) // with the predictor, the rear is for short-lived blocks and the front for the others
+    {
+        key = LIFE_KEY(adjsize, AR_SITE(arena));
+        rear = life_predict(key);
+    }
 
-    // If no fit found, get more memory and place the block
-    if ((bp = find_fit(adjsize)) == NULL) 
+    // a block of exactly this size freed recently is still allocated, so just hand it out again.
+    q = QUICK_INDEX(adjsize);
+    if ((AR_QSIZE(arena, q) == adjsize) && ((bp = AR_QUICK(arena, q)) != NULL))
     {
+        AR_QUICK(arena, q) = SUCC(bp);
+        AR_QCOUNT(arena, q)--;
+        AR_QTOTAL(arena)--;
+        CLR_GROWN(HDRP(bp)); // the new owner starts without the old one's realloc history
+        if (AR_LIFE(arena) != NULL) life_born(bp, key);
+        return bp;
+    }
+
+    // a short-lived block is taken from the top block of the heap if it fits there.
+    bp = NULL;
+    if ((AR_LIFE(arena) != NULL) && rear && ((bp = AR_WILD(arena)) != NULL) && (GET_SIZE(HDRP(bp)) < adjsize)) bp = NULL;
+    // If no fit found, use the top block, getting more memory for it if needed, and place the block
+    if ((bp == NULL) && ((bp = find_fit(adjsize)) == NULL))
+    {
+        // the blocks held in the quick-lists may coalesce into a fit, so free them before growing the heap.
+        if ((AR_QTOTAL(arena) > 0) && (quick_sweep(-1) > 0)) bp = find_fit(adjsize);
         //printf("Malloc: extending the heap.\n");
-        if ((bp = extend_heap(adjsize)) == NULL) return NULL; // cannot extend heap
+        if ((bp == NULL) && ((bp = wild_fit(adjsize)) == NULL)) return NULL; // cannot extend heap
     }
     //printf("Malloc: find_fit suggestes %p\n", bp); 
-    return place(bp, adjsize); // allocate by placing the block
+    bp = place(bp, adjsize, rear); // allocate by placing the block
+    if (AR_LIFE(arena) != NULL) life_born(bp, key);
+    return bp;
     //printf("Malloc: allocated at %p\n", bp); 
     //return bp;
 }
 
 /*
- * mm_free - Freeing a block
+ * arena_memalign - Allocate an aligned block in the current arena. The misaligned front of
+ * the free block it comes from is split off as a free block of its own.
  */
-void mm_free(void *ptr)
+static void *arena_memalign(size_t align, size_t size)
+{
+    size_t adjsize, need;
+    void *bp;
+
+    if ((size == 0) || (size > MAX_REQUEST)) return NULL;
+    if ((size >= MMAP_THRESHOLD) && (align <= MAP_PAGE)) return map_alloc(size, align); // a region is page aligned
+    if (size <= MPAYLOAD) adjsize = MSIZE;
+    else adjsize = ALIGN(WSIZE + size);
+
+    // any free block of this size has an aligned payload with room for a free block in front of it.
+    need = adjsize + align + MSIZE;
+    if ((bp = find_fit(need)) == NULL)
+    {
+        if ((AR_QTOTAL(arena) > 0) && (quick_sweep(-1) > 0)) bp = find_fit(need);
+        if ((bp == NULL) && ((bp = wild_fit(need)) == NULL)) return NULL;
+    }
+    return carve(bp, align, adjsize);
+}
+
+/*
+ * arena_calloc - Allocate a zeroed block in the current arena. Only the part below AR_FRESH may hold old
+ * data; above it, just the links and the footer of the free block it came from need clearing.
+ */
+static void *arena_calloc(size_t size)
+{
+    char *fresh = AR_FRESH(arena);
+    char *bp, *end, *ftr;
+
+    if ((bp = arena_malloc(size)) == NULL) return NULL;
+    if (slab_test(bp) || buddy_test(bp)) return memset(bp, 0, size); // no tags to go by
+    if (IS_MAPPED(bp)) return bp; // a new mapping is zero already
+    end = bp + size;
+    fresh = MIN(MAX(fresh, bp + 2*LSIZE), end);
+    if (fresh > bp) memset(bp, 0, fresh - bp); // memset clears large blocks with vector stores
+    if (fresh < end)
+    {
+        ftr = bp + GET_SIZE(HDRP(bp)) - DSIZE;
+        if (ftr < end) memset(ftr, 0, end - ftr);
+        //printf("Calloc: %d of %d bytes were fresh\n", end - fresh, size);
+    }
+    return bp;
+}
+
+/*
+ * arena_free - Freeing a block of the current arena
+ */
+static void arena_free(void *ptr)
 {
     //printf("\n Entering Free: \n");
     if (ptr == 0) return; // do nothing
+    if (slab_test(ptr)) // slab objects have no boundary tags
+    {
+        slab_free(ptr);
+        return;
+    }
+    if (buddy_test(ptr)) // and neither have buddy blocks
+    {
+        buddy_free(ptr);
+        return;
+    }
+    if (IS_MAPPED(ptr))
+    {
+        map_free(ptr);
+        return;
+    }
+    if (AR_LIFE(arena) != NULL) life_died(ptr);
+
+    size_t size = GET_SIZE(HDRP(ptr));
+    if ((size <= ALIGN(WSIZE + SLAB_MAX)) && (AR_SMALL_LIVE(arena) > 0)) AR_SMALL_LIVE(arena)--;
+    BUDDY_GONE(size - WSIZE);
+    if ((size <= QUICK_MAX) && quick_push(ptr, size)) return; // keep it allocated in its quick-list if the slot holds this size
+    free_block(ptr);
+}
+
+#ifndef MM_THREADS
+/*
+ * arena_free_sized - Free a block of the current arena whose payload size the caller knows. A small block
+ * goes to the quick-list of that size without its header being read; the block may be larger than the size
+ * says (a split remainder too small to keep, or realloc's reserve), which is fine for reuse, and then the
+ * header is only read when the quick-list is swept. A GROWN bit stays set until the block is handed out again.
+ */
+static void arena_free_sized(void *ptr, size_t size)
+{
+    size_t adjsize;
+
+    if (slab_test(ptr))
+    {
+        slab_free(ptr);
+        return;
+    }
+    if (buddy_test(ptr))
+    {
+        buddy_free(ptr);
+        return;
+    }
+    if (size <= MPAYLOAD) adjsize = MSIZE;
+    else adjsize = ALIGN(WSIZE + size);
+    if (adjsize > QUICK_MAX) // the seglists need the real size
+    {
+        arena_free(ptr);
+        return;
+    }
+    if ((size <= SLAB_MAX) && (AR_SMALL_LIVE(arena) > 0)) AR_SMALL_LIVE(arena)--;
+    BUDDY_GONE(size);
+    if (AR_LIFE(arena) != NULL) life_died(ptr);
+    if (!quick_push(ptr, adjsize)) free_block(ptr);
+}
+#endif
+
+/*
+ * arena_malloc_batch - Allocate up to n blocks of size bytes in the current arena. After the quick-list,
+ * each free block found is cut into as many blocks as it holds (or as are left) in one pass, and the heap
+ * grows once for all that remain. Returns how many blocks were allocated.
+ */
+static int arena_malloc_batch(size_t size, int n, void **out)
+{
+    size_t adjsize;
+    char *bp;
+    int k = 0, m, q;
+
+    if ((size == 0) || (size > MAX_REQUEST)) return 0;
+    if ((size >= MMAP_THRESHOLD) || (size <= SLAB_MAX) || BUDDY_FITS(size)) // mappings, slab slots or buddy blocks: nothing to share
+    {
+        for (; k < n; k++) if ((out[k] = arena_malloc(size)) == NULL) break;
+        return k;
+    }
+    if (size <= MPAYLOAD) adjsize = MSIZE;
+    else adjsize = ALIGN(WSIZE + size);
+
+    q = QUICK_INDEX(adjsize);
+    if (AR_QSIZE(arena, q) == adjsize)
+    {
+        while ((k < n) && ((bp = AR_QUICK(arena, q)) != NULL))
+        {
+            AR_QUICK(arena, q) = SUCC(bp);
+            AR_QCOUNT(arena, q)--;
+            AR_QTOTAL(arena)--;
+            CLR_GROWN(HDRP(bp));
+            out[k++] = bp;
+        }
+    }
+    while (k < n)
+    {
+        // a block for all of the rest, else one for at least one of them.
+        m = n - k;
+        if (((bp = find_fit(m * adjsize)) == NULL) && ((bp = find_fit(adjsize)) == NULL))
+        {
+            if ((AR_QTOTAL(arena) > 0) && (quick_sweep(-1) > 0)) bp = find_fit(adjsize);
+            if ((bp == NULL) && ((bp = wild_fit(m * adjsize)) == NULL)) break;
+        }
+        m = MIN(m, (int)(GET_SIZE(HDRP(bp)) / adjsize));
+        place_batch(bp, adjsize, m, out + k);
+        k += m;
+    }
+    return k;
+}
+
+/*
+ * arena_free_batch - Free n blocks of the current arena, sorted by address. A run of blocks that lie
+ * next to each other is freed as one block, so it is coalesced once; a block on its own is freed as usual.
+ */
+static void arena_free_batch(void **ptrs, int n)
+{
+    size_t size, bsize;
+    char *bp;
+    int i, j;
+
+    for (i = 0; i < n; i = j)
+    {
+        bp = ptrs[i];
+        j = i + 1;
+        if (bp == NULL) continue;
+        if (slab_test(bp) || buddy_test(bp) || IS_MAPPED(bp))
+        {
+            arena_free(bp);
+            continue;
+        }
+        size = GET_SIZE(HDRP(bp));
+        // a slab object is never at the start of a block, but a buddy chunk starts with one of its blocks
+        while ((j < n) && ((char *)ptrs[j] == bp + size) && !buddy_test(ptrs[j]))
+        {
+            if (AR_LIFE(arena) != NULL) life_died(ptrs[j]);
+            bsize = GET_SIZE(HDRP(ptrs[j]));
+            if ((bsize <= ALIGN(WSIZE + SLAB_MAX)) && (AR_SMALL_LIVE(arena) > 0)) AR_SMALL_LIVE(arena)--;
+            BUDDY_GONE(bsize - WSIZE);
+            size += bsize;
+            j++;
+        }
+        if (j == i + 1)
+        {
+            arena_free(bp);
+            continue;
+        }
+        if ((GET_SIZE(HDRP(bp)) <= ALIGN(WSIZE + SLAB_MAX)) && (AR_SMALL_LIVE(arena) > 0)) AR_SMALL_LIVE(arena)--;
+        BUDDY_GONE(GET_SIZE(HDRP(bp)) - WSIZE);
+        if (AR_LIFE(arena) != NULL) life_died(bp);
+        PUT(HDRP(bp), PACK(size, 1) | GET_PREV_ALLOC(HDRP(bp))); // the run becomes one allocated block
+        free_block(bp);
+    }
+}
+
+/* arena_lifetime - the prediction arena_malloc would make for the request; -1 before the predictor starts */
+static int arena_lifetime(size_t size, int site)
+{
+    size_t adjsize = (size <= MPAYLOAD) ? MSIZE : ALIGN(WSIZE + size);
 
+    if ((AR_LIFE(arena) == NULL) || (size == 0) || (size > MAX_REQUEST)) return -1;
+    return life_predict(LIFE_KEY(adjsize, site));
+}
+
+/* ptr_cmp - qsort order of pointers by address */
+static int ptr_cmp(const void *a, const void *b)
+{
+    size_t x = (size_t)*(void * const *)a;
+    size_t y = (size_t)*(void * const *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * quick_push - Keep the allocated block ptr in the quick-list for size if its slot holds that size; returns whether it did
+ */
+static int quick_push(void *ptr, size_t size)
+{
+    int q = QUICK_INDEX(size);
+
+    if (AR_QUICK(arena, q) == NULL) AR_QSIZE(arena, q) = size;
+    if (AR_QSIZE(arena, q) != size) return 0;
+    SET(SP(ptr), AR_QUICK(arena, q));
+    AR_QUICK(arena, q) = ptr;
+    AR_QTOTAL(arena)++;
+    if (++AR_QCOUNT(arena, q) > QUICK_LIMIT) quick_sweep(q);
+    return 1;
+}
+
+/*
+ * free_block - Mark an allocated block free and put it in the seglists, coalescing it with its neighbours
+ */
+static void free_block(void *ptr)
+{
     size_t size = GET_SIZE(HDRP(ptr));
-    PUT(HDRP(ptr), PACK(size, 0)); // set header
+    PUT(HDRP(ptr), PACK(size, 0) | GET_PREV_ALLOC(HDRP(ptr))); // set header
     PUT(FTRP(ptr), PACK(size, 0)); // and footer bits to zero
+    CLR_PREV_ALLOC(HDRP(NEXT_BLKP(ptr))); // tell the next block
     
     add_node(ptr); // after freeing, add the block to the appropriate seglist
-    coalesce(ptr); // if necessary, coalesce it. 
+    trim_heap(coalesce(ptr)); // if necessary, coalesce it. 
 }
 
 /*
- * mm_realloc - Implemented simply in terms of mm_malloc and mm_free
+ * trim_heap - Shrink the heap when the free block bp is the last one and larger than TRIM_THRESHOLD.
+ * TRIM_THRESHOLD/2 bytes of it are kept, so freeing and allocating around the top does not
+ * move brk back and forth. The threaded build never trims: other arenas may own the frames above.
  */
-void *mm_realloc(void *ptr, size_t size)
+static void trim_heap(void *bp)
+{
+#ifndef MM_THREADS
+    size_t size = GET_SIZE(HDRP(bp));
+    size_t keep = ALIGN(TRIM_THRESHOLD / 2);
+
+    if ((size <= TRIM_THRESHOLD) || ((char *)bp + size != AR_BRK(arena))) return; // small, or not at the top of the last segment
+    if (mem_sbrk(-(intptr_t)(size - keep)) == (void *)-1) return;
+    AR_HEAP(arena) -= size - keep;
+    MARK_DIRTY((char *)bp + size); // the old footer and epilogue stay behind, where the heap may grow back
+    //printf("Trim: released %d bytes.\n", size - keep);
+    remove_node(bp);
+    PUT(HDRP(bp), PACK(keep, 0) | GET_PREV_ALLOC(HDRP(bp)));
+    PUT(FTRP(bp), PACK(keep, 0));
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); // new epilogue
+    AR_BRK(arena) = (char *)bp + keep;
+    add_node(bp);
+#endif
+}
+
+/*
+ * quick_sweep - Free the blocks of quick-list q (all of them if q < 0) for real; returns how many
+ */
+static int quick_sweep(int q)
+{
+    int i = (q < 0) ? 0 : q;
+    int last = (q < 0) ? NQUICK - 1 : q;
+    int n = 0;
+    void *bp, *next;
+
+    for (; i <= last; i++)
+    {
+        bp = AR_QUICK(arena, i);
+        AR_QUICK(arena, i) = NULL;
+        AR_QTOTAL(arena) -= AR_QCOUNT(arena, i);
+        AR_QCOUNT(arena, i) = 0;
+        for (; bp != NULL; bp = next, n++)
+        {
+            next = SUCC(bp); // read the link before the block becomes a free list node
+            free_block(bp);
+        }
+    }
+    return n;
+}
+
+/*
+ * arena_realloc - Resize a block of the current arena, in place when possible
+ */
+static void *arena_realloc(void *ptr, size_t size)
 {
     //printf("\n Entering Realloc: \n");
     void *oldptr = ptr;
@@ -181,213 +1178,688 @@ void *mm_realloc(void *ptr, size_t size)
     if (size == 0) 
     {
         //printf("Realloc: size = 0, so free\n");
-        mm_free(ptr);
+        arena_free(ptr);
         return NULL;
     }
     // when ptr is NULL, then same with mm_malloc
     else if (ptr == NULL) 
     {
         //printf("Realloc: ptr = 0, so mm_malloc\n");
-        return mm_malloc(size);
+        return arena_malloc(size);
+    }
+    if (size > MAX_REQUEST) return NULL;
+    // a slab object stays in its slot while it fits, otherwise it moves to a new block.
+    if (slab_test(ptr))
+    {
+        oldsize = RUN_SLOT(RUN_BASE(ptr));
+        if (size <= oldsize) return oldptr;
+        if ((newptr = arena_malloc(size)) == NULL) return NULL;
+        memcpy(newptr, oldptr, oldsize);
+        slab_free(oldptr);
+        return newptr;
+    }
+    // a buddy block stays put while the size needs its order, otherwise it moves.
+    if (buddy_test(ptr))
+    {
+        oldsize = buddy_size(ptr);
+        if ((size <= oldsize) && (2*size > oldsize)) return oldptr;
+        if ((newptr = arena_malloc(size)) == NULL) return NULL;
+        memcpy(newptr, oldptr, MIN(size, oldsize));
+        buddy_free(oldptr);
+        return newptr;
     }
+    if (IS_MAPPED(ptr)) return map_realloc(ptr, size);
     // when ptr is not NULL, then use my big brain :)
     oldsize = GET_SIZE(HDRP(ptr)); // originally allocated size
     if (size <= MPAYLOAD) newsize = MSIZE;
-    else newsize = ALIGN(size + DSIZE); // align the new size. 
+    else newsize = ALIGN(size + WSIZE); // align the new size. 
 
     // newsize is same or smaller than the original
     if (oldsize == newsize) return oldptr; // keep the block still. 
+    // a growing block that still fits in its reserve is not touched; only a real shrink gives the reserve back.
+    if (GET_GROWN(HDRP(oldptr)) && (oldsize > newsize) && (oldsize - newsize <= (oldsize >> GROW_SHIFT))) return oldptr;
     if (oldsize > newsize) // when newsize is smaller, re-place the block and split if necessary.
     {
         //printf("Realloc: newsize is smaller\n");
-        return realloc_place(oldptr, newsize);
+        return realloc_place(oldptr, newsize); // the new header clears GROWN
     }
-    else // when the newsize > oldsize
+    else if (size < MMAP_THRESHOLD) // when the newsize > oldsize (a huge one moves to a mapping below)
     {
+        // the second grow of a block is likely followed by more, so take some room for them now.
+        size_t want = newsize;
+        if (GET_GROWN(HDRP(oldptr))) want = ALIGN(newsize + (newsize >> GROW_SHIFT));
         //printf("Realloc: newsize is larger\n");
         // if any next block is empty, try using that space first!
         void *next = NEXT_BLKP(oldptr);
-        if (GET_SIZE(HDRP(next)) == 0) // check whether next is an epilogue 
+        if ((GET_SIZE(HDRP(next)) == 0) || ((next == AR_WILD(arena)) && (oldsize + GET_SIZE(HDRP(next)) < want)))
         {
-            // if next block is an epilogue, then extend the heap.
-            size_t extendsize = MAX((newsize - oldsize), 32);
+            // if next block is an epilogue, or the top block but too small, then extend the heap by the shortfall.
+            // (in threaded mode the heap may grow in a new region instead, and next stays the epilogue.)
+            size_t have = GET_SIZE(HDRP(next)); // 0 for the epilogue
+            size_t extendsize = MAX((want - oldsize - have), 32);
             if ((extend_heap(extendsize)) == NULL) return NULL;
-            oldsize += extendsize;
-            remove_node(next);
-            PUT(HDRP(oldptr), PACK(oldsize, 1));
-            PUT(FTRP(oldptr), PACK(oldsize, 1));
-            return realloc_place(oldptr, newsize);
         }
-        if (GET_ALLOC(HDRP(next)) == 0)
+        size_t nextsize = GET_ALLOC(HDRP(next)) ? 0 : GET_SIZE(HDRP(next));
+        size_t prevsize = GET_PREV_ALLOC(HDRP(oldptr)) ? 0 : GET_SIZE(HDRP(PREV_BLKP(oldptr)));
+        if (oldsize + nextsize >= newsize) // the next block is enough, so the payload stays where it is
+        {
+            //printf("Realloc: using the next block\n");
+            remove_node(next); // first capture the free list. 
+            PUT(HDRP(oldptr), PACK(oldsize + nextsize, 1) | GET_PREV_ALLOC(HDRP(oldptr)));
+            SET_PREV_ALLOC(HDRP(NEXT_BLKP(oldptr)));
+            newptr = realloc_place(oldptr, MIN(want, oldsize + nextsize));
+            SET_GROWN(HDRP(newptr));
+            MARK_DIRTY(NEXT_BLKP(newptr));
+            return newptr;
+        }
+        if (prevsize + oldsize + nextsize >= newsize) // with the previous block (and the next one) it is enough
+        {
+            //printf("Realloc: using the previous block\n");
+            void *prev = PREV_BLKP(oldptr);
+            remove_node(prev); // its links are in the way of the payload
+            if (nextsize > 0) remove_node(next);
+            PUT(HDRP(prev), PACK(prevsize + oldsize + nextsize, 1) | GET_PREV_ALLOC(HDRP(prev)));
+            memmove(prev, oldptr, oldsize - WSIZE); // the payload slides down over the old header
+            SET_PREV_ALLOC(HDRP(NEXT_BLKP(prev)));
+            newptr = realloc_place(prev, MIN(want, prevsize + oldsize + nextsize));
+            SET_GROWN(HDRP(newptr));
+            MARK_DIRTY(NEXT_BLKP(newptr));
+            return newptr;
+        }
+        size = want - WSIZE;
+    }
+    // when all cases fail, then allocate to a whole new place.
+    if ((newptr = arena_malloc(size)) == NULL) return NULL;
+    // copy the data as data is located at newptr. only the payload, not the header.
+    memcpy(newptr, oldptr, oldsize - WSIZE);
+    // free the old block. (Adios!)
+    arena_free(oldptr);
+    if (!slab_test(newptr) && !buddy_test(newptr) && !IS_MAPPED(newptr)) SET_GROWN(HDRP(newptr));
+    return newptr;
+}
+
+//////////////////////////////* HELPER FUNCTIONS *///////////////////////////////
+/* find_fit - Find any free blocks to fit memory to be allocated  */
+static void *find_fit(size_t adjsize)
+{
+    //printf("\n Entering Find Fit: \n");
+    switch (fit_policy) // the other policies, see FIT_BEST
+    {
+    case FIT_FIRST: return first_fit(adjsize);
+    case FIT_NEXT: return next_fit(adjsize);
+    case FIT_GOOD: return good_fit(adjsize);
+    }
+    int seg_index = find_index(adjsize); // first find the appropriate size. 
+    int i = seg_index;
+    //printf("Find Fit: size %d belongs to seglist[%d]\n", adjsize, i); 
+    void **listp = find_list(seg_index);
+    void *bp = *listp;
+    // first, find the appropriate size in the free list (or the best fit in the treap). 
+    if (seg_index >= TREE_INDEX) bp = tree_best_fit(bp, adjsize);
+    else
+    {
+        while ((bp != NULL) && (adjsize > GET_SIZE(HDRP(bp))))
+        {
+            bp = SUCC(bp);
+        }
+    }
+    if (bp != NULL) return bp; // if found a appropriate size. 
+    // if not, move to the larger sized segregated free list. 
+    //printf("Find Fit: not available in the seglist[%d]\n", seg_index);
+    // the bitmap tells which larger seglists are non-empty, so jump straight to the first one. 
+    unsigned int larger = (i < 23) ? (AR_BITMAP(arena) & (~0u << (i + 1))) : 0;
+    if (larger == 0) return NULL; // no appropriate block in all segregated free lists, prepare for extend heap. 
+    i = __builtin_ctz(larger);
+    //printf("Find Fit: Next index is now %d\n", i);   
+    listp = find_list(i);
+    bp = *listp;
+    if (i >= TREE_INDEX) // the smallest node of a treap is its leftmost node
+    {
+        while (LEFT(bp) != NULL) bp = LEFT(bp);
+    }
+    return bp; // just get the smallest available. 
+}
+
+/* fit_setup - read the fit policy from MM_FIT; anything it does not know means best fit */
+static void fit_setup(void)
+{
+    char *env = getenv("MM_FIT");
+
+    fit_policy = FIT_BEST;
+    fit_probes = 8;
+    fit_slack = 25;
+    if (env == NULL) return;
+    if (strcmp(env, "first") == 0) fit_policy = FIT_FIRST;
+    else if (strcmp(env, "next") == 0) fit_policy = FIT_NEXT;
+    else if (strncmp(env, "good", 4) == 0)
+    {
+        fit_policy = FIT_GOOD;
+        sscanf(env + 4, ":%d:%d", &fit_probes, &fit_slack);
+        fit_probes = MAX(fit_probes, 1);
+        fit_slack = MAX(fit_slack, 0);
+    }
+}
+
+/* first_fit - the first block that fits: in list order, on the treap search path, or the head of a larger class */
+static void *first_fit(size_t adjsize)
+{
+    int i = find_index(adjsize);
+    void *bp = *find_list(i);
+
+    if (i >= TREE_INDEX) // smaller nodes send the search right, and the first one that fits ends it
+    {
+        while ((bp != NULL) && (adjsize > GET_SIZE(HDRP(bp)))) bp = RIGHT(bp);
+    }
+    else
+    {
+        while ((bp != NULL) && (adjsize > GET_SIZE(HDRP(bp)))) bp = SUCC(bp);
+    }
+    if (bp != NULL) return bp;
+    // every block of a larger class fits, so take the head of the first non-empty one (the root of a treap).
+    if ((i = larger_class(i)) < 0) return NULL;
+    return *find_list(i);
+}
+
+/*
+ * life_init - give the current arena its lifetime predictor table, from the heap without going through arena_malloc.
+ * the table waits for a free block below the top one, so it never stands in the way of a block growing at the top.
+ */
+static void life_init(void)
+{
+    size_t adjsize = ALIGN(WSIZE + LIFE_SIZE);
+    void *bp;
+
+    if ((bp = find_fit(adjsize)) == NULL) return;
+    bp = place(bp, adjsize, 0);
+    memset(bp, 0, LIFE_SIZE);
+    AR_LIFE(arena) = bp;
+}
+
+/* life_predict - whether blocks of this key have mostly been short-lived */
+static int life_predict(unsigned int key)
+{
+    char *t = AR_LIFE(arena);
+    return LIFE_SHORTS(t, key) > LIFE_LONGS(t, key);
+}
+
+/* life_born - sample the birth of bp, settling the block it pushes out of the table if that one is old already */
+static void life_born(void *bp, unsigned int key)
+{
+    char *t = AR_LIFE(arena);
+    unsigned int i = LIFE_SLOT(bp);
+
+    if ((LIFE_PTR(t, i) != NULL) && (AR_TICK(arena) - LIFE_BIRTH(t, i) >= MM_SHORT_LIVED)) life_learn(LIFE_KEYOF(t, i), 0);
+    LIFE_PTR(t, i) = bp;
+    LIFE_BIRTH(t, i) = AR_TICK(arena);
+    LIFE_KEYOF(t, i) = key;
+}
+
+/* life_died - if ptr is sampled, teach its key how long it lived */
+static void life_died(void *ptr)
+{
+    char *t = AR_LIFE(arena);
+    unsigned int i = LIFE_SLOT(ptr);
+
+    if (LIFE_PTR(t, i) != ptr) return;
+    life_learn(LIFE_KEYOF(t, i), AR_TICK(arena) - LIFE_BIRTH(t, i) < MM_SHORT_LIVED);
+    LIFE_PTR(t, i) = NULL;
+}
+
+/* life_learn - count one more short or long life for key */
+static void life_learn(unsigned int key, int short_lived)
+{
+    char *t = AR_LIFE(arena);
+
+    if (short_lived) LIFE_SHORTS(t, key)++;
+    else LIFE_LONGS(t, key)++;
+    if (LIFE_SHORTS(t, key) + LIFE_LONGS(t, key) >= LIFE_LEARN)
+    {
+        LIFE_SHORTS(t, key) /= 2;
+        LIFE_LONGS(t, key) /= 2;
+    }
+}
+
+/* larger_class - the first non-empty seglist above i, or -1 */
+static int larger_class(int i)
+{
+    unsigned int larger = (i < 23) ? (AR_BITMAP(arena) & (~0u << (i + 1))) : 0;
+    return (larger == 0) ? -1 : __builtin_ctz(larger);
+}
+
+/* next_fit - first fit from the rover on, wrapping around to the head of the list. remove_node moves the rover on. */
+static void *next_fit(size_t adjsize)
+{
+    int i = find_index(adjsize);
+    void *rover = AR_ROVER(arena);
+    void *bp;
+
+    if ((i >= TREE_INDEX) || (rover == NULL) || (find_index(GET_SIZE(HDRP(rover))) != i)) bp = first_fit(adjsize);
+    else
+    {
+        for (bp = rover; (bp != NULL) && (adjsize > GET_SIZE(HDRP(bp))); bp = SUCC(bp));
+        if (bp == NULL) // wrap around
+        {
+            for (bp = *find_list(i); (bp != rover) && (adjsize > GET_SIZE(HDRP(bp))); bp = SUCC(bp));
+            if (bp == rover) bp = ((i = larger_class(i)) < 0) ? NULL : *find_list(i); // only a larger class is left
+        }
+    }
+    if ((bp != NULL) && (find_index(GET_SIZE(HDRP(bp))) < TREE_INDEX)) AR_ROVER(arena) = bp;
+    return bp;
+}
+
+/* good_fit - best fit, cut short by a block within fit_slack percent of the request or after fit_probes blocks */
+static void *good_fit(size_t adjsize)
+{
+    int i = find_index(adjsize), probes = 0;
+    size_t close = adjsize + adjsize * fit_slack / 100;
+    void *bp = *find_list(i);
+    void *fit = NULL;
+
+    if (i >= TREE_INDEX) // the best fit descent, stopped early once there is a candidate
+    {
+        while (bp != NULL)
+        {
+            probes++;
+            if (GET_SIZE(HDRP(bp)) >= adjsize)
+            {
+                fit = bp;
+                if ((GET_SIZE(HDRP(bp)) <= close) || (probes >= fit_probes)) break;
+                bp = LEFT(bp);
+            }
+            else bp = RIGHT(bp);
+        }
+    }
+    else // sorted, so the first fit is the best of the class; past fit_probes blocks, a larger class will do
+    {
+        for (; (bp != NULL) && (probes < fit_probes); bp = SUCC(bp), probes++)
         {
-            // if next block is a free block, combine it and check whether sum of size is sufficient.  
-            //printf("Realloc: next block is available\n");
-            size_t freesize = GET_SIZE(HDRP(next));
-            oldsize += freesize;
-            // if the size + next size <= newsize, then use the next block!
-            if (newsize <= oldsize)
+            if (GET_SIZE(HDRP(bp)) >= adjsize)
             {
-                //printf("Realloc: using the next block\n");
-                remove_node(next); // first capture the free list. 
-                PUT(HDRP(oldptr), PACK(oldsize, 1));
-                PUT(FTRP(oldptr), PACK(oldsize, 1));
-                return realloc_place(oldptr, newsize);
+                fit = bp;
+                break;
             }
         }
     }
-    // when all cases fail, then allocate to a whole new place.
-    if ((newptr = mm_malloc(size)) == NULL) return NULL;
-    // copy the data as data is located at newptr.
-    memcpy(newptr, oldptr, oldsize);
-    // free the old block. (Adios!)
-    mm_free(oldptr);
-    return newptr;
+    if (fit != NULL) return fit;
+    if ((i = larger_class(i)) < 0) return NULL;
+    bp = *find_list(i);
+    if (i >= TREE_INDEX) // towards the smallest node, as far as the probes allow
+    {
+        for (probes = 0; (LEFT(bp) != NULL) && (GET_SIZE(HDRP(bp)) > close) && (probes < fit_probes); probes++) bp = LEFT(bp);
+    }
+    return bp;
+}
+
+/* realloc_place & place - Place the block to allocate, split if necessary */
+static void *realloc_place(void *bp, size_t adjsize)
+{
+    //printf("\n Entering Realloc Place: \n");
+    void *new_bp;
+    //printf("R_Place: size for allocation is %d bytes\n", adjsize);
+    size_t csize = GET_SIZE(HDRP(bp)); // csize = size of the allocated block
+    //printf("R_Place: size of available block is %d bytes\n", csize);
+    // the payload is already in the front, so the block stays there and the rear is split off.
+    if ((csize - adjsize) >= 32) // split the block if remainder >= 32B
+    {
+        //printf("R_Place: splitting the block\n");
+        PUT(HDRP(bp), PACK(adjsize, 1) | GET_PREV_ALLOC(HDRP(bp))); 
+        // split the block
+        new_bp = NEXT_BLKP(bp);
+        PUT(HDRP(new_bp), PACK(csize - adjsize, 0) | PREV_ALLOC); 
+        PUT(FTRP(new_bp), PACK(csize - adjsize, 0));
+        CLR_PREV_ALLOC(HDRP(NEXT_BLKP(new_bp)));
+        // add the split free block to the seglist, merging it with a free block after it. 
+        add_node(new_bp);
+        coalesce(new_bp);
+    }
+    //printf("R_Place: no split needed.\n");
+    return bp;
+}
+
+/* place - after find_fit, allocate the free block. */
+static void* place(void *bp, size_t adjsize, int rear)
+{
+    //printf("\n Entering Place: \n");
+    void *new_bp;
+    //printf("Place: size for allocation is %d bytes\n", adjsize);
+    size_t csize = GET_SIZE(HDRP(bp)); // csize = size of the free block
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    //printf("Place: size of available block is %d bytes\n", csize);
+
+    // the top block is cut from the front, so what is left stays at the top. a block that takes most of it goes to
+    // the top instead, where realloc can grow it, and the small rest below joins the seglists.
+    if ((bp == AR_WILD(arena)) && (csize - adjsize >= adjsize)) rear = 0;
+    remove_node(bp); // first, remove the node from its segregated free list. 
+    if ((csize - adjsize) >= MSIZE) // split the block if remainder >= 16B
+    {
+        size_t released = GET_RELEASED(HDRP(bp)); // the free part keeps its pages released
+        if (rear)
+        {
+            PUT(HDRP(bp), PACK(csize - adjsize, 0) | prev_alloc | released); 
+            PUT(FTRP(bp), PACK(csize - adjsize, 0));
+            add_node(bp);
+            new_bp = NEXT_BLKP(bp);
+            PUT(HDRP(new_bp), PACK(adjsize, 1)); // previous block is the free front part
+            SET_PREV_ALLOC(HDRP(NEXT_BLKP(new_bp)));
+            MARK_DIRTY(NEXT_BLKP(new_bp));
+            return new_bp;
+            
+        }
+        PUT(HDRP(bp), PACK(adjsize, 1) | prev_alloc); 
+
+        new_bp = NEXT_BLKP(bp);
+        PUT(HDRP(new_bp), PACK(csize - adjsize, 0) | PREV_ALLOC | released); 
+        PUT(FTRP(new_bp), PACK(csize - adjsize, 0));
+        //printf("Place: adding split remainder with size (%d) at %p\n", GET_SIZE(HDRP(new_bp)), new_bp);
+        add_node(new_bp);
+        MARK_DIRTY(new_bp);
+        return bp;
+    }
+    else
+    {
+        //printf("Place: no split needed.\n");
+        PUT(HDRP(bp), PACK(csize, 1) | prev_alloc);
+        SET_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+        MARK_DIRTY(NEXT_BLKP(bp));
+        return bp;
+    }
+}
+
+/* place_batch - allocate n blocks of adjsize bytes from the start of the free block bp in one pass, the rest stays free */
+static void place_batch(void *bp, size_t adjsize, int n, void **out)
+{
+    size_t csize = GET_SIZE(HDRP(bp));
+    size_t rest = csize - n * adjsize;
+    size_t released = GET_RELEASED(HDRP(bp));
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    char *p = bp;
+    int k;
+
+    remove_node(bp);
+    for (k = 0; k < n; k++)
+    {
+        if ((k == n - 1) && (rest < MSIZE)) adjsize += rest; // a remainder too small for a block goes with the last one
+        PUT(HDRP(p), PACK(adjsize, 1) | prev_alloc);
+        prev_alloc = PREV_ALLOC;
+        out[k] = p;
+        p += adjsize;
+    }
+    if (rest >= MSIZE)
+    {
+        PUT(HDRP(p), PACK(rest, 0) | PREV_ALLOC | released);
+        PUT(FTRP(p), PACK(rest, 0));
+        add_node(p);
+    }
+    else SET_PREV_ALLOC(HDRP(p));
+    MARK_DIRTY(p);
+}
+
+/* arena_new - lay an arena header at p, followed by its first region which ends at limit. it becomes the current arena. */
+static char *arena_new(char *p, char *limit, int index)
+{
+    arena = p;
+    seglist_init();
+    AR_INDEX(arena) = index;
+#ifdef MM_THREADS
+    pthread_mutex_init(AR_LOCK(arena), NULL);
+#endif
+    AR_BRK(arena) = region_init(arena + AR_SIZE);
+    AR_LIMIT(arena) = limit;
+    AR_FRESH(arena) = MAX(AR_BRK(arena), (char *)mem_fresh_lo()); // a heap from an earlier run is not zero
+    return arena;
+}
+
+/* region_init - put a prologue and an epilogue at p, and return the first byte after the epilogue */
+static char *region_init(char *p)
+{
+    PUT(p, 0);                                               /* Alignment Padding */
+    PUT(p + ALIGNMENT - WSIZE, PACK(ALIGNMENT, 1));          /* Prologue header */
+    PUT(p + 2*ALIGNMENT - DSIZE, PACK(ALIGNMENT, 1));        /* Prologue footer */
+    PUT(p + 2*ALIGNMENT - WSIZE, PACK(0, 1) | PREV_ALLOC);   /* Epilogue header */
+    return p + 2*ALIGNMENT;
+}
+
+/* arena_sbrk - like mem_sbrk, but for the current arena: returns the old brk of the arena, just after its epilogue */
+static char *arena_sbrk(size_t incr)
+{
+    char *bp = AR_BRK(arena);
+#ifdef MM_THREADS
+    if (bp + incr > AR_LIMIT(arena)) // the current region is full, take more of the heap
+    {
+        size_t len;
+        char *p, *q;
+        pthread_mutex_lock(ROOT_LOCK);
+        if ((char *)mem_heap_hi() + 1 == AR_LIMIT(arena)) // no other arena grew since, so the region just gets longer
+        {
+            len = bp + incr - AR_LIMIT(arena);
+            p = mem_sbrk(len);
+        }
+        else
+        {
+            len = incr + 2*ALIGNMENT;
+            p = frame_sbrk(len);
+        }
+        if (p != (void *)-1)
+        {
+            for (q = FRAME_UP(p); q < p + len; q += CHUNK) ROOT_FRAME(q) = AR_INDEX(arena); // the frames it reaches into
+        }
+        pthread_mutex_unlock(ROOT_LOCK);
+        if (p == (void *)-1) return (void *)-1;
+        if (p != AR_LIMIT(arena)) bp = region_init(p);
+        AR_LIMIT(arena) = p + len;
+    }
+#else
+    if (mem_sbrk(incr) == (void *)-1) // the segment is full, continue in a new one with its own prologue
+    {
+        char *p;
+        if ((p = mem_segment(incr + 2*ALIGNMENT)) == (void *)-1) return (void *)-1;
+        bp = region_init(p);
+    }
+#endif
+    AR_BRK(arena) = bp + incr;
+    AR_HEAP(arena) += incr;
+    return bp;
+}
+
+#ifdef MM_THREADS
+/* frame_sbrk - take len bytes of the heap from the start of the next frame (with ROOT_LOCK held). the rest of the
+ * frame below stays unused, as the region of the arena that owns it cannot grow past another arena's frame. */
+static char *frame_sbrk(size_t len)
+{
+    char *top = (char *)mem_heap_hi() + 1;
+
+    if ((top != FRAME_UP(top)) && (mem_sbrk(FRAME_UP(top) - top) == (void *)-1)) return (void *)-1;
+    return mem_sbrk(len);
+}
+
+/* thread_init - on the first call of a thread (for this heap), pick its home arena and make its cache */
+static void thread_init(void)
+{
+    char *p;
+    int i;
+
+    if (thread_gen == heap_gen) return;
+    pthread_mutex_lock(ROOT_LOCK);
+    i = next_arena++ % MM_ARENAS;
+    if (ROOT_ARENA(i) == NULL) // first thread of this arena, give it a frame
+    {
+        if ((p = frame_sbrk(AR_SIZE + 2*ALIGNMENT)) == (void *)-1) i = 0; // out of memory, share the first arena
+        else
+        {
+            ROOT_FRAME(p) = i;
+            ROOT_ARENA(i) = arena_new(p, p + AR_SIZE + 2*ALIGNMENT, i);
+        }
+    }
+    home = ROOT_ARENA(i);
+    pthread_mutex_unlock(ROOT_LOCK);
+    thread_gen = heap_gen;
+
+    LOCK(home);
+    arena = home;
+    tcache = arena_malloc(TC_SIZE);
+    UNLOCK(home);
+    if (tcache == NULL) return; // works without a cache
+    memset(tcache, 0, TC_SIZE);
+    if (tc_key_made) pthread_setspecific(tc_key, tcache);
+}
+
+/* thread_exit - give everything in the cache of an exiting thread back to the arenas */
+static void thread_exit(void *tc)
+{
+    int c;
+
+    if ((thread_gen != heap_gen) || (tc != tcache)) return; // the heap was reset since
+    for (c = 0; c < TC_CLASSES; c++) tcache_flush(c, 0);
+    tcache = NULL;
+    TC_NEXT(tc) = NULL;
+    arena_give(OWNER(tc), tc, tc);
+}
+
+/* tcache_fill - take TC_REFILL blocks for cache class c from the home arena, under one lock */
+static void tcache_fill(int c)
+{
+    void *bp;
+    int k;
+
+    LOCK(home);
+    arena = home;
+    remote_drain(); // blocks other threads gave back are the first to reuse
+    for (k = 0; k < TC_REFILL; k++)
+    {
+        if ((bp = arena_malloc((c + 1) * TC_STEP)) == NULL) break;
+        TC_NEXT(bp) = TC_HEAD(tcache, c);
+        TC_HEAD(tcache, c) = bp;
+        TC_COUNT(tcache, c)++;
+    }
+    UNLOCK(home);
 }
 
-//////////////////////////////* HELPER FUNCTIONS *///////////////////////////////
-/* find_fit - Find any free blocks to fit memory to be allocated  */
-static void *find_fit(size_t adjsize)
+/* tcache_flush - keep the keep most recently freed blocks of cache class c, and free the rest in their arenas */
+static void tcache_flush(int c, int keep)
 {
-    //printf("\n Entering Find Fit: \n");
-    int seg_index = find_index(adjsize); // first find the appropriate size. 
-    int i = seg_index;
-    //printf("Find Fit: size %d belongs to seglist[%d]\n", adjsize, i); 
-    void **listp = find_list(seg_index);
-    void *bp = *listp;
-    // first, find the appropriate size in the free list. 
-    while ((bp != NULL) && (adjsize > GET_SIZE(HDRP(bp))))
+    char *owner;
+    void *bp = TC_HEAD(tcache, c);
+    void *last, *next;
+    int k;
+
+    if (keep == 0) TC_HEAD(tcache, c) = NULL;
+    else
     {
-        bp = SUCC(bp);
+        for (k = 1; (k < keep) && (bp != NULL); k++) bp = TC_NEXT(bp);
+        if (bp == NULL) return;
+        next = TC_NEXT(bp);
+        TC_NEXT(bp) = NULL;
+        bp = next;
     }
-    if (bp != NULL) return bp; // if found a appropriate size. 
-    // if not, move to the larger sized segregated free list. 
-    //printf("Find Fit: not available in the seglist[%d]\n", seg_index);
-    while (i < 23)
+    TC_COUNT(tcache, c) = keep;
+    while (bp != NULL) // blocks of one arena tend to come together, so give them back in one go
     {
-        i++; // traverse from seg_index + 1 to 23. 
-        //printf("Find Fit: Next index is now %d\n", i);   
-        listp = find_list(i);
-        if (*listp != NULL) 
-        {
-            bp = *listp;
-            //printf("Find Fit: block size %d bytes in seglist[%d] \n", GET_SIZE(HDRP(bp)), i);
-            return bp; // just get the smallest available. 
-        }
+        owner = OWNER(bp);
+        for (last = bp; (TC_NEXT(last) != NULL) && (OWNER(TC_NEXT(last)) == owner); last = TC_NEXT(last));
+        next = TC_NEXT(last);
+        TC_NEXT(last) = NULL;
+        arena_give(owner, bp, last);
+        bp = next;
     }
-    // when no such appropriate block in all segregated free list:
-    //printf("Find Fit: failed to find any blocks, prepare for extend heap.\n");
-    return NULL;
 }
 
-/* realloc_place & place - Place the block to allocate, split if necessary */
-static void *realloc_place(void *bp, size_t adjsize)
+/* arena_give - free the NULL-terminated chain first..last of blocks from arena owner.
+ * the home arena frees them under its lock, any other arena gets them pushed on its remote list with one CAS. */
+static void arena_give(char *owner, void *first, void *last)
 {
-    //printf("\n Entering Realloc Place: \n");
-    void *new_bp;
-    //printf("R_Place: size for allocation is %d bytes\n", adjsize);
-    size_t csize = GET_SIZE(HDRP(bp)); // csize = size of the free block
-    //printf("R_Place: size of available block is %d bytes\n", csize);
-    if ((csize - adjsize) >= 32) // split the block if remainder >= 24B
+    void *next;
+
+    if (owner != home)
     {
-        if (adjsize >= 32)
-        {
-            PUT(HDRP(bp), PACK(csize - adjsize, 0)); 
-            PUT(FTRP(bp), PACK(csize - adjsize, 0));
-            add_node(bp);
-            new_bp = NEXT_BLKP(bp);
-            PUT(HDRP(new_bp), PACK(adjsize, 1));
-            PUT(FTRP(new_bp), PACK(adjsize, 1));
-            return new_bp;     
-        }
-        //printf("R_Place: splitting the block\n");
-        PUT(HDRP(bp), PACK(adjsize, 1)); 
-        PUT(FTRP(bp), PACK(adjsize, 1));
-        // split the block
-        new_bp = NEXT_BLKP(bp);
-        PUT(HDRP(new_bp), PACK(csize - adjsize, 0)); 
-        PUT(FTRP(new_bp), PACK(csize - adjsize, 0));
-        // add the split free block to the seglist. 
-        add_node(new_bp);
-        return bp;
+        void *head = __atomic_load_n(&AR_REMOTE(owner), __ATOMIC_RELAXED);
+        do TC_NEXT(last) = head;
+        while (!__atomic_compare_exchange_n(&AR_REMOTE(owner), &head, first, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+        return;
     }
-    else
+    LOCK(home);
+    arena = home;
+    remote_drain();
+    while (first != NULL)
     {
-        //printf("R_Place: no split needed.\n");
-        PUT(HDRP(bp), PACK(csize, 1));
-        PUT(HDRP(bp), PACK(csize, 1));
-        return bp;
+        next = TC_NEXT(first);
+        arena_free(first);
+        first = next;
     }
+    UNLOCK(home);
 }
 
-/* place - after find_fit, allocate the free block. */
-static void* place(void *bp, size_t adjsize)
+/* remote_drain - free the blocks other threads pushed on the remote list of the current arena, whose lock is held.
+ * only lock holders take the list, and they take all of it, so a plain exchange is enough. */
+static void remote_drain(void)
 {
-    //printf("\n Entering Place: \n");
-    void *new_bp;
-    //printf("Place: size for allocation is %d bytes\n", adjsize);
-    size_t csize = GET_SIZE(FTRP(bp)); // csize = size of the free block
-    //printf("Place: size of available block is %d bytes\n", csize);
-
-    if ((csize - adjsize) >= MSIZE) // split the block if remainder >= 24B
-    {
-        remove_node(bp); // first, remove the node from its segregated free list. 
-        // allocating at the rear side of the free block can inprove the utilization as coalescing is more likely.
-        if (adjsize >= 32)
-        {
-            PUT(HDRP(bp), PACK(csize - adjsize, 0)); 
-            PUT(FTRP(bp), PACK(csize - adjsize, 0));
-            add_node(bp);
-            new_bp = NEXT_BLKP(bp);
-            PUT(HDRP(new_bp), PACK(adjsize, 1));
-            PUT(FTRP(new_bp), PACK(adjsize, 1));
-            return new_bp;
-            
-        }
-        PUT(HDRP(bp), PACK(adjsize, 1)); 
-        PUT(FTRP(bp), PACK(adjsize, 1));
+    void *bp, *next;
 
-        new_bp = NEXT_BLKP(bp);
-        PUT(HDRP(new_bp), PACK(csize - adjsize, 0)); 
-        PUT(FTRP(new_bp), PACK(csize - adjsize, 0));
-        //printf("Place: adding split remainder with size (%d) at %p\n", GET_SIZE(HDRP(new_bp)), new_bp);
-        add_node(new_bp);
-        return bp;
-    }
-    else
+    if (__atomic_load_n(&AR_REMOTE(arena), __ATOMIC_RELAXED) == NULL) return;
+    bp = __atomic_exchange_n(&AR_REMOTE(arena), NULL, __ATOMIC_ACQUIRE);
+    while (bp != NULL)
     {
-        //printf("Place: no split needed.\n");
-        remove_node(bp);
-        PUT(HDRP(bp), PACK(csize, 1));
-        PUT(HDRP(bp), PACK(csize, 1));
-        return bp;
+        next = TC_NEXT(bp);
+        arena_free(bp);
+        bp = next;
     }
 }
+#endif
 
-/* extend_heap - extend the heap size by increasing brk pointer value with sbrk */
+/*
+ * extend_heap - extend the heap size by increasing brk pointer value with sbrk. the heap grows by size bytes,
+ * or by a chunk of 1/2^CHUNK_SHIFT of the arena's size (CHUNKSIZE to CHUNK_MAX bytes) if that is more, so an
+ * arena that keeps growing calls sbrk less often. memlib's own sizes are shared by all arenas, so they are not read here. returns the top block, which the new bytes are added to.
+ */
 static void *extend_heap(size_t size)
 {
     //printf("\n Entering Extend Heap: \n");
     void *bp;
-    size_t adjsize = ALIGN(size); // make sure to align in DSIZE
-    if ((bp = mem_sbrk(adjsize)) == (void*)-1) return NULL; // failed extending the heap. 
+    char *wild = AR_WILD(arena);
+    size_t chunk = MIN(MAX(AR_HEAP(arena) >> CHUNK_SHIFT, CHUNKSIZE), CHUNK_MAX);
+    size_t adjsize = ALIGN(MAX(size, chunk)); // make sure to align in DSIZE
+    if ((bp = arena_sbrk(adjsize)) == (void*)-1) return NULL; // failed extending the heap. 
     //printf("Extend Heap: extended %d bytes.\n", adjsize);
-    PUT(HDRP(bp), PACK(adjsize, 0));
+    if ((wild != NULL) && (NEXT_BLKP(wild) == bp)) // the top block just gets longer
+    {
+        adjsize += GET_SIZE(HDRP(wild));
+        PUT(HDRP(wild), PACK(adjsize, 0) | GET_PREV_ALLOC(HDRP(wild)));
+        PUT(FTRP(wild), PACK(adjsize, 0));
+        PUT(HDRP(NEXT_BLKP(wild)), PACK(0, 1));
+        // the old footer and the old epilogue are now inside the top block: clear them, so it stays fresh.
+        memset((char *)bp - DSIZE, 0, DSIZE);
+        return wild;
+    }
+    PUT(HDRP(bp), PACK(adjsize, 0) | GET_PREV_ALLOC(HDRP(bp))); // the old epilogue knows about the last block
     PUT(FTRP(bp), PACK(adjsize, 0));
     PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));
-    add_node(bp); // add extended area (a free block) in to a DLL
+    if (wild != NULL) // the heap went on in a new segment or region, so the old top block is an ordinary free block now
+    {
+        AR_WILD(arena) = NULL;
+        add_node(wild);
+    }
+    add_node(bp); // the extended area becomes the top block
+    return bp;
+}
+
+/* wild_fit - when find_fit misses, the top block, grown by the shortfall if it is smaller than adjsize */
+static void *wild_fit(size_t adjsize)
+{
+    char *bp = AR_WILD(arena);
+    size_t wsize = (bp != NULL) ? GET_SIZE(HDRP(bp)) : 0;
 
-    // merge with the extend block with prev free block if any, and return merged bp.
-    return coalesce(bp);
+    if (wsize >= adjsize) return bp;
+    if (2*wsize < adjsize) wsize = 0; // a top block under half the request is left to smaller ones (see place)
+    if ((bp = extend_heap(adjsize - wsize)) == NULL) return NULL;
+    // if the heap went on in a new segment or region, the new top block has only the shortfall: grow it once more.
+    if (GET_SIZE(HDRP(bp)) < adjsize) bp = extend_heap(adjsize - GET_SIZE(HDRP(bp)));
+    return bp;
 }
 
 /* coalesce - merge the free adjacent blocks if any exists. */
 static void *coalesce(void *bp)
 {
     //printf("\n Entering Coalesce: \n");
-    void *prev_blkp = PREV_BLKP(bp); // pointer to the previous block.
-    size_t prev_alloc = ((prev_blkp == bp) ? 1 : GET_ALLOC(HDRP(prev_blkp)));
-    // intially, when prev block is not there, PREV_BLKP returns the bp, which is stupid. 
-    // must check whether the prev_alloc is not same with bp. 
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp)); // the prologue counts as allocated
 
     //printf("Coalesce: previous block is at %p\n", PREV_BLKP(bp));
     //printf("Coalesce: previous block size is %d bytes\n", GET_SIZE(HDRP(PREV_BLKP(bp))));
@@ -396,6 +1868,7 @@ static void *coalesce(void *bp)
     //printf("Coalesce: next block is at %p\n", NEXT_BLKP(bp));
     //printf("Coalesce: next block size is %d bytes\n", GET_SIZE(HDRP(NEXT_BLKP(bp))));
     size_t size = GET_SIZE(HDRP(bp));
+    char *lo = bp, *hi = (char *)bp + size; // the part whose pages may still be in memory
 
     //printf("Coalesce: a block to be merged is at %p\n", bp);
     //printf("Coalesce: a block to be merged size is %d bytes \n", size);
@@ -403,17 +1876,18 @@ static void *coalesce(void *bp)
     if (prev_alloc && next_alloc) 
     {
         //printf("Coalesce: no merging\n");
-        return bp;
-    } // both prev and next allocated, stop.
+    } // both prev and next allocated, nothing to merge.
     else if (prev_alloc && !next_alloc) // next block free
     {
         //printf("Coalesce: merge with next block\n");
         size += GET_SIZE(HDRP(NEXT_BLKP(bp))); // add the size, updating the block size
         //printf("Coalesce: merged size is %d bytes\n", size);
+        MARK_DIRTY((char *)NEXT_BLKP(bp) + 2*LSIZE); // the links of next are left inside the merged block
+        if (!GET_RELEASED(HDRP(NEXT_BLKP(bp)))) hi += GET_SIZE(HDRP(NEXT_BLKP(bp)));
         remove_node(bp);
         remove_node(NEXT_BLKP(bp)); // connect the pointers of doubly linked free list
         
-        PUT(HDRP(bp), PACK(size, 0)); // update header 
+        PUT(HDRP(bp), PACK(size, 0) | PREV_ALLOC); // update header 
         PUT(FTRP(bp), PACK(size, 0)); // update footer
 
         add_node(bp); // now add the merged block
@@ -423,11 +1897,12 @@ static void *coalesce(void *bp)
         //printf("Coalesce: merge with prev block\n");
         size += GET_SIZE(HDRP(PREV_BLKP(bp)));
         //printf("Coalesce: merged size is %d bytes\n", size);
+        if (!GET_RELEASED(HDRP(PREV_BLKP(bp)))) lo = PREV_BLKP(bp);
         remove_node(bp);
 	    remove_node(PREV_BLKP(bp)); // connect the pointers of doubly linked free list
         
         PUT(FTRP(bp), PACK(size, 0));
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
+        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0) | GET_PREV_ALLOC(HDRP(PREV_BLKP(bp))));
         bp = PREV_BLKP(bp); // move the bp to the prev block's pointer
 
         add_node(bp);
@@ -437,20 +1912,39 @@ static void *coalesce(void *bp)
         //printf("Coalesce: merge with both block\n");
         size += GET_SIZE(HDRP(PREV_BLKP(bp))) + GET_SIZE(FTRP(NEXT_BLKP(bp))); // add both sizes of prev and next
         //printf("Coalesce: merged size is %d bytes\n", size);
+        MARK_DIRTY((char *)NEXT_BLKP(bp) + 2*LSIZE);
+        if (!GET_RELEASED(HDRP(NEXT_BLKP(bp)))) hi += GET_SIZE(HDRP(NEXT_BLKP(bp)));
+        if (!GET_RELEASED(HDRP(PREV_BLKP(bp)))) lo = PREV_BLKP(bp);
         remove_node(bp);
         remove_node(NEXT_BLKP(bp)); // connect the pointers of doubly linked free list
         remove_node(PREV_BLKP(bp)); // connect the pointers of doubly linked free list
         
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0)); 
+        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0) | GET_PREV_ALLOC(HDRP(PREV_BLKP(bp)))); 
         PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));
         bp = PREV_BLKP(bp); // move the bp to the prev block's pointer
 
         add_node(bp);
     }
     //printf("Coalesce: merged block is at %p\n", bp);
+    release_pages(bp, lo, hi); // a large free block only needs its boundary tags and links in memory
     return bp; // return the pointer of merged free block
 }
 
+/*
+ * release_pages - give the whole pages of lo..hi inside a large free block back, keeping its header, links and footer.
+ * coalesce passes the merged block less the released blocks it took in, so their pages are not advised again.
+ */
+static void release_pages(void *bp, char *lo, char *hi)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+
+    if (size < DECOMMIT_THRESHOLD) return; // small
+    if ((char *)bp + size == AR_BRK(arena)) return; // the top block is left to trim_heap, and is reused first
+    lo = PAGE_UP(MAX(lo, (char *)bp + 2*LSIZE));
+    hi = PAGE_DOWN(MIN(hi, FTRP(bp)));
+    if ((hi <= lo) || (mem_decommit(lo, hi - lo) == 0)) SET_RELEASED(HDRP(bp));
+}
+
 /* remove_node - removes the node from the segregated free list */
 static void remove_node(void *bp)
 {
@@ -459,10 +1953,23 @@ static void remove_node(void *bp)
     int seg_index = find_index(size); // find which seglist to put.
     void **listp = find_list(seg_index);
     //printf("Remove Node: removing a node from the %d list\n", seg_index);
+    if (bp == AR_WILD(arena)) // the top block is in no list
+    {
+        AR_WILD(arena) = NULL;
+        return;
+    }
+    if (bp == AR_ROVER(arena)) AR_ROVER(arena) = (seg_index >= TREE_INDEX) ? NULL : SUCC(bp); // next fit goes on after it
+    if (seg_index >= TREE_INDEX)
+    {
+        *listp = tree_remove(*listp, bp);
+        if (*listp == NULL) AR_BITMAP(arena) &= ~(1u << seg_index);
+        return;
+    }
 
     if ((SUCC(bp) == NULL) && (PRED(bp) == NULL)) // last single free block
     {
         *listp = NULL; // no free blocks now.
+        AR_BITMAP(arena) &= ~(1u << seg_index);
         return; 
     }
     if ((SUCC(bp) == NULL) && (PRED(bp) != NULL)) // bp is the tail node; no succ block
@@ -492,6 +1999,17 @@ static void add_node(void *bp)
     int seg_index = find_index(size); // find which seglist to put.
     void** listp = find_list(seg_index);
     //printf("Add Node: adding the node to the seglist[%d] \n", seg_index);
+    if (NEXT_BLKP(bp) == AR_BRK(arena)) // the top block is kept apart, for when no seglist has a fit (see wild_fit)
+    {
+        AR_WILD(arena) = bp;
+        return;
+    }
+    if (seg_index >= TREE_INDEX)
+    {
+        *listp = tree_insert(*listp, bp);
+        AR_BITMAP(arena) |= (1u << seg_index);
+        return;
+    }
     void *walk = *listp;
     void *here = NULL;
     if (*listp == NULL) // nothing in the seglist's DLL
@@ -499,9 +2017,10 @@ static void add_node(void *bp)
         SET(SP(bp), NULL);
         SET(PP(bp), NULL); // Alone in the DLL...
         *listp = bp; // bp is the new head
+        AR_BITMAP(arena) |= (1u << seg_index);
         return;
     }
-    if (*listp != NULL) // something is in the seglist's DLL
+    if (FIT_SORTED) // something is in the seglist's DLL; unsorted lists just take bp at the head
     {
         while (size > GET_SIZE(HDRP(walk)))
         {
@@ -539,124 +2058,502 @@ static void add_node(void *bp)
     return;
 }
 
-/* find_index - get the proper index of segregated free list according to its size */
-static int find_index(size_t size)
+/* slab_alloc - hand out a free slot of the smallest slot class that holds size bytes */
+static void *slab_alloc(size_t size)
 {
-    // under 256B, seglist is divided into 32B interval
-    int k = ((int)size) >> 5;
-    if (k < 8) return k;
-
-    // after 256B, seglist interval is powers of 2. 
-    size_t search = size;
-    int seg_index = 8;
-    do {
-        if (search >= 256)
+    int i = (int)((size - 1) / ALIGNMENT); // slot class: ALIGNMENT, 2*ALIGNMENT, ... SLAB_MAX
+    void **listp = find_slab(i);
+    void *run = *listp;
+    unsigned int *map;
+    int w = 0;
+    int slot;
+
+    if (run == NULL) // no run with a free slot, make a new one
+    {
+        if ((run = slab_new_run((i + 1) * ALIGNMENT)) == NULL) return NULL;
+        *listp = run;
+    }
+    map = RUN_MAP(run);
+    while (map[w] == 0) w++; // the run is on the list, so some word has a free bit
+    slot = (w << 5) + __builtin_ctz(map[w]);
+    map[w] &= map[w] - 1; // take the lowest free bit
+
+    if (--RUN_FREE(run) == 0) // run is full, drop it from the list
+    {
+        *listp = SUCC(run);
+        if (*listp != NULL) SET(PP(*listp), NULL);
+    }
+    return (char *)run + RUN_FIRST(run) + slot * RUN_SLOT(run);
+}
+
+/* slab_free - give a slot back to its run, and the run back to the heap once it is empty */
+static void slab_free(void *ptr)
+{
+    char *run = RUN_BASE(ptr);
+    void **listp = find_slab(RUN_SLOT(run) / ALIGNMENT - 1);
+    unsigned int slot = ((char *)ptr - run - RUN_FIRST(run)) / RUN_SLOT(run);
+
+    RUN_MAP(run)[slot >> 5] |= 1u << (slot & 31);
+    if (RUN_FREE(run)++ == 0) // run was full, put it back on the list
+    {
+        SET(SP(run), *listp);
+        SET(PP(run), NULL);
+        if (*listp != NULL) SET(PP(*listp), run);
+        *listp = run;
+        return;
+    }
+    // keep the last run of a class around so a single object does not make a run come and go.
+    if ((RUN_FREE(run) == RUN_NSLOTS(run)) && ((*listp != run) || (SUCC(run) != NULL)))
+    {
+        if (PRED(run) != NULL) SET(SP(PRED(run)), SUCC(run));
+        else *listp = SUCC(run);
+        if (SUCC(run) != NULL) SET(PP(SUCC(run)), PRED(run));
+        int frame = (int)((run - RUN_BASE(mem_heap_lo())) / RUNSIZE);
+        ATOMIC_AND(&slab_map[frame >> 5], ~(1u << (frame & 31)));
+        arena_free(run); // now an ordinary allocated block
+    }
+}
+
+/* slab_test - whether ptr points into a slab run */
+static int slab_test(void *ptr)
+{
+    if (((char *)ptr < slab_lo) || ((char *)ptr >= slab_hi)) return 0;
+    int frame = (int)((RUN_BASE(ptr) - RUN_BASE(mem_heap_lo())) / RUNSIZE);
+    return (ATOMIC_GET(&slab_map[frame >> 5]) >> (frame & 31)) & 1;
+}
+
+/* slab_new_run - get a RUNSIZE-aligned block for a run of slot-byte slots and format it */
+static void *slab_new_run(size_t slot)
+{
+    char *run;
+    int words, nslots, i, frame;
+
+    if (slab_map == NULL) // first run ever, set up the frame map
+    {
+        if ((slab_map = arena_malloc(SLAB_MAPSIZE)) == NULL) return NULL;
+        memset(slab_map, 0, SLAB_MAPSIZE);
+    }
+
+    // runs stay in the first segment, so tiny blocks past it are normal blocks.
+    if ((run = aligned_block(RUNSIZE, RUNSIZE)) == NULL) return NULL;
+
+    // bitmap words and slots share the payload: 8*slot + 1 bits per slot.
+    nslots = ((RUNSIZE - WSIZE - RUN_HDR) * 8) / (8 * slot + 1);
+    words = (nslots + 31) >> 5;
+    while (ALIGN(RUN_HDR + words*WSIZE) + nslots*slot > RUNSIZE - WSIZE) 
+    {
+        nslots--;
+        words = (nslots + 31) >> 5;
+    }
+    RUN_SLOT(run) = slot;
+    RUN_FREE(run) = nslots;
+    RUN_NSLOTS(run) = nslots;
+    RUN_FIRST(run) = ALIGN(RUN_HDR + words*WSIZE);
+    for (i = 0; i < words; i++) RUN_MAP(run)[i] = ~0u;
+    if (nslots & 31) RUN_MAP(run)[words - 1] = (1u << (nslots & 31)) - 1;
+    SET(SP(run), NULL);
+    SET(PP(run), NULL);
+
+    frame = (int)((run - RUN_BASE(mem_heap_lo())) / RUNSIZE);
+    ATOMIC_OR(&slab_map[frame >> 5], 1u << (frame & 31));
+    if ((slab_lo == NULL) || (run < slab_lo)) slab_lo = run;
+    if (run + RUNSIZE > slab_hi) slab_hi = run + RUNSIZE;
+    return run;
+}
+
+/*
+ * aligned_block - allocate an adjsize-byte block whose payload is align-aligned, inside the first heap segment,
+ * which the frame maps cover. returns NULL if it would not fit there.
+ */
+static void *aligned_block(size_t align, size_t adjsize)
+{
+    void *bp;
+
+    // any free block of this size holds an aligned block with room for the leftover blocks on both sides.
+    bp = find_fit(adjsize + align + 2*MSIZE);
+    if ((bp != NULL) && ((char *)bp + adjsize + 2*align > SLAB_END)) return NULL;
+    // otherwise grow the heap so the block at the top of the arena can hold one.
+    // this takes a second round when the heap grows in a new region or segment.
+    while (bp == NULL)
+    {
+        char *brk = AR_BRK(arena);
+        char *start = GET_PREV_ALLOC(HDRP(brk)) ? brk : PREV_BLKP(brk);
+        char *base = (char *)(((size_t)start + align - 1) & ~(align - 1));
+        if ((base > start) && (base - start < MSIZE)) base += align;
+        if (base + adjsize > SLAB_END) return NULL;
+        long need = (base + adjsize) - brk;
+        long extendsize = MAX(need, 0);
+        // both the extension and the leftover block after the aligned one must be 0 or at least MSIZE.
+        while (((extendsize > 0) && (extendsize < MSIZE)) || 
+               ((extendsize - need > 0) && (extendsize - need < MSIZE))) extendsize += DSIZE;
+        if (extendsize == 0) bp = start;
+        else if (extend_heap(extendsize) == NULL) return NULL;
+    }
+    return carve(bp, align, adjsize);
+}
+
+#ifdef MM_BUDDY
+/* buddy_alloc - take a free block of the smallest order that holds size bytes, splitting a larger one if need be */
+static void *buddy_alloc(size_t size)
+{
+    char *bp;
+    int k = 0, j;
+
+    if (!buddy_on) // a chunk pays off once the heap holds about that much in medium blocks
+    {
+        if ((buddy_live += size) < BUDDY_WARMUP) return NULL; // the caller uses a normal block
+        buddy_on = 1;
+    }
+    while ((size_t)(BUDDY_MIN << k) < size) k++;
+    if (size <= (BUDDY_MIN << k) - (BUDDY_MIN << k >> BUDDY_SLACK)) return NULL; // too much would be lost to rounding
+    for (j = k; (j < NBUDDY) && (AR_BUDDY(arena, j) == NULL); j++);
+    if (j == NBUDDY)
+    {
+        if (buddy_new_chunk() == NULL) return NULL; // the caller falls back to a normal block
+        j = BUDDY_TOP;
+    }
+    bp = AR_BUDDY(arena, j);
+    buddy_unlink(bp, j);
+    while (j > k) // the upper half of each split is the buddy of the lower one, which goes on
+    {
+        j--;
+        buddy_link(bp + (BUDDY_MIN << j), j);
+    }
+    BUDDY_ORDER(BUDDY_BASE(bp), bp) = k;
+    return bp;
+}
+
+/* buddy_free - merge a block with its buddy as long as that one is free as a whole, then list the result */
+static void buddy_free(void *ptr)
+{
+    char *chunk = BUDDY_BASE(ptr);
+    char *bp = ptr, *mate;
+    int k = BUDDY_ORDER(chunk, bp), b;
+    size_t i;
+
+    for (; k < BUDDY_TOP; k++)
+    {
+        mate = chunk + ((size_t)(bp - chunk) ^ ((size_t)BUDDY_MIN << k));
+        b = BUDDY_BIT(chunk, mate, k);
+        if (!((BUDDY_BITS(chunk)[b >> 5] >> (b & 31)) & 1)) break; // in use, or split with a part in use
+        buddy_unlink(mate, k);
+        bp = MIN(bp, mate);
+    }
+    // keep one empty chunk around so a single block does not make a chunk come and go; the others go back to the heap.
+    if ((k == BUDDY_TOP) && (AR_BUDDY(arena, BUDDY_TOP) != NULL))
+    {
+        for (i = 0; i < BUDDY_PAGES; i++) buddy_map[BUDDY_PAGE(chunk) + i] = 0;
+        arena_free(chunk); // now an ordinary allocated block
+        return;
+    }
+    buddy_link(bp, k);
+}
+
+/* buddy_test - whether ptr is a block of a buddy chunk; those are page aligned */
+static int buddy_test(void *ptr)
+{
+    if (((size_t)ptr & (BUDDY_MIN - 1)) || ((char *)ptr < buddy_lo) || ((char *)ptr >= buddy_hi)) return 0;
+    return buddy_map[BUDDY_PAGE(ptr)] != 0;
+}
+
+/* buddy_size - the size of an allocated buddy block */
+static size_t buddy_size(void *ptr)
+{
+    return (size_t)BUDDY_MIN << BUDDY_ORDER(BUDDY_BASE(ptr), ptr);
+}
+
+/*
+ * buddy_new_chunk - get a page-aligned block with room for the metadata after the chunk, and list it whole.
+ * it comes from a free block or the top block, so the heap grows by less than a page besides the chunk.
+ */
+static void *buddy_new_chunk(void)
+{
+    char *chunk;
+    size_t i, page;
+
+    if (buddy_map == NULL) // first chunk ever, set up the page map. it is a medium block itself, so not from arena_malloc
+    {
+        size_t adjsize = ALIGN(WSIZE + BUDDY_MAPSIZE);
+        void *bp;
+        if (((bp = find_fit(adjsize)) == NULL) && ((bp = wild_fit(adjsize)) == NULL)) return NULL;
+        buddy_map = place(bp, adjsize, 0);
+        memset(buddy_map, 0, BUDDY_MAPSIZE);
+    }
+    if ((chunk = aligned_block(BUDDY_MIN, ALIGN(WSIZE + BUDDY_CHUNK + BUDDY_META))) == NULL) return NULL;
+
+    page = BUDDY_PAGE(chunk);
+    for (i = 0; i < BUDDY_PAGES; i++) buddy_map[page + i] = (unsigned int)page + 1;
+    memset(BUDDY_BITS(chunk), 0, (2*BUDDY_PAGES / 32) * WSIZE);
+    if ((buddy_lo == NULL) || (chunk < buddy_lo)) buddy_lo = chunk;
+    if (chunk + BUDDY_CHUNK > buddy_hi) buddy_hi = chunk + BUDDY_CHUNK;
+    buddy_link(chunk, BUDDY_TOP);
+    return chunk;
+}
+
+/* buddy_link - mark bp a free block of order k and push it on the arena list of that order */
+static void buddy_link(char *bp, int k)
+{
+    char *chunk = BUDDY_BASE(bp);
+    int b = BUDDY_BIT(chunk, bp, k);
+
+    BUDDY_ORDER(chunk, bp) = k;
+    BUDDY_BITS(chunk)[b >> 5] |= 1u << (b & 31);
+    BUDDY_NEXT(bp) = AR_BUDDY(arena, k);
+    BUDDY_PREV(bp) = NULL;
+    if (AR_BUDDY(arena, k) != NULL) BUDDY_PREV(AR_BUDDY(arena, k)) = bp;
+    AR_BUDDY(arena, k) = bp;
+}
+
+/* buddy_unlink - take the free block bp of order k off its list */
+static void buddy_unlink(char *bp, int k)
+{
+    char *chunk = BUDDY_BASE(bp);
+    int b = BUDDY_BIT(chunk, bp, k);
+
+    BUDDY_BITS(chunk)[b >> 5] &= ~(1u << (b & 31));
+    if (BUDDY_PREV(bp) != NULL) BUDDY_NEXT(BUDDY_PREV(bp)) = BUDDY_NEXT(bp);
+    else AR_BUDDY(arena, k) = BUDDY_NEXT(bp);
+    if (BUDDY_NEXT(bp) != NULL) BUDDY_PREV(BUDDY_NEXT(bp)) = BUDDY_PREV(bp);
+}
+#endif
+
+/* map_alloc - give a huge request a region of its own, with the payload align (a power of two up to MAP_PAGE) bytes in */
+static void *map_alloc(size_t size, size_t align)
+{
+    size_t offset = MAX(align, ALIGNMENT);
+    size_t pages = (size + offset + MAP_PAGE - 1) / MAP_PAGE;
+    char *p;
+
+    MAP_LOCK();
+    p = mem_map(pages * MAP_PAGE);
+    MAP_UNLOCK();
+    if (p == (void *)-1) return NULL;
+    PUT(p + offset - DSIZE, pages);
+    PUT(p + offset - WSIZE, PACK(0, 1));
+    return p + offset;
+}
+
+/* map_free - give the region of a huge block back right away */
+static void map_free(void *ptr)
+{
+    MAP_LOCK();
+    mem_unmap(MAP_BASE(ptr));
+    MAP_UNLOCK();
+}
+
+/* map_realloc - resize a huge block with mem_remap, which moves pages instead of copying; a small one goes back to the heap */
+static void *map_realloc(void *ptr, size_t size)
+{
+    size_t offset = (char *)ptr - MAP_BASE(ptr);
+    size_t pages = (size + offset + MAP_PAGE - 1) / MAP_PAGE;
+    void *newptr;
+    char *p;
+
+    if (size < MMAP_THRESHOLD)
+    {
+        if ((newptr = mm_malloc(size)) == NULL) return NULL;
+        memcpy(newptr, ptr, size);
+        map_free(ptr);
+        return newptr;
+    }
+    if (pages == MAP_PAGES(ptr)) return ptr;
+    MAP_LOCK();
+    p = mem_remap(MAP_BASE(ptr), pages * MAP_PAGE);
+    MAP_UNLOCK();
+    if (p == (void *)-1) return NULL;
+    PUT(p + offset - DSIZE, pages);
+    return p + offset;
+}
+
+/* 
+ * carve - allocate the first adjsize-byte block whose payload is align-aligned inside the free block bp.
+ * the parts before and after it stay free; the caller makes sure bp is large enough.
+ */
+static void *carve(void *bp, size_t align, size_t adjsize)
+{
+    size_t csize = GET_SIZE(HDRP(bp));
+    char *base = (char *)(((size_t)bp + align - 1) & ~(align - 1));
+    size_t front, tail;
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+
+    if ((base > (char *)bp) && (base - (char *)bp < MSIZE)) base += align; // front block must be MSIZE at least
+    front = base - (char *)bp;
+    tail = csize - front - adjsize;
+    if (tail < MSIZE) // too small to be a block, so it goes with the allocation
+    {
+        adjsize += tail;
+        tail = 0;
+    }
+    remove_node(bp);
+    if (front > 0) // the leading part stays free
+    {
+        PUT(HDRP(bp), PACK(front, 0) | prev_alloc);
+        PUT(FTRP(bp), PACK(front, 0));
+        add_node(bp);
+        prev_alloc = 0;
+    }
+    PUT(HDRP(base), PACK(adjsize, 1) | prev_alloc);
+    if (tail > 0) // and so does the trailing part
+    {
+        PUT(HDRP(NEXT_BLKP(base)), PACK(tail, 0) | PREV_ALLOC);
+        PUT(FTRP(NEXT_BLKP(base)), PACK(tail, 0));
+        add_node(NEXT_BLKP(base));
+    }
+    else SET_PREV_ALLOC(HDRP(NEXT_BLKP(base)));
+    MARK_DIRTY(NEXT_BLKP(base));
+    return base;
+}
+
+/* tree_insert - inserts bp into the treap rooted at root and returns the new root. */
+static void *tree_insert(void *root, void *bp)
+{
+    void *child;
+    if (root == NULL) // bp becomes a leaf
+    {
+        SET(SP(bp), NULL);
+        SET(PP(bp), NULL);
+        return bp;
+    }
+    if (KEY_LESS(bp, root))
+    {
+        child = tree_insert(LEFT(root), bp);
+        SET(SP(root), child);
+        if (tree_prio(child) > tree_prio(root)) // rotate right to restore the heap order
         {
-            search = search >> 1;
-            seg_index++;
+            SET(SP(root), RIGHT(child));
+            SET(PP(child), root);
+            return child;
         }
-        else
+    }
+    else
+    {
+        child = tree_insert(RIGHT(root), bp);
+        SET(PP(root), child);
+        if (tree_prio(child) > tree_prio(root)) // rotate left to restore the heap order
         {
-            break;
+            SET(PP(root), LEFT(child));
+            SET(SP(child), root);
+            return child;
         }
-    } while (seg_index < 23); 
-    
-    return seg_index;
+    }
+    return root;
+}
+
+/* tree_remove - removes bp from the treap rooted at root and returns the new root. */
+static void *tree_remove(void *root, void *bp)
+{
+    void *child;
+    if (root == bp) return tree_merge(LEFT(bp), RIGHT(bp));
+    if (KEY_LESS(bp, root))
+    {
+        child = tree_remove(LEFT(root), bp);
+        SET(SP(root), child);
+    }
+    else
+    {
+        child = tree_remove(RIGHT(root), bp);
+        SET(PP(root), child);
+    }
+    return root;
+}
+
+/* tree_merge - joins two treaps where every key of a is smaller than every key of b. */
+static void *tree_merge(void *a, void *b)
+{
+    if (a == NULL) return b;
+    if (b == NULL) return a;
+    void *child;
+    if (tree_prio(a) > tree_prio(b))
+    {
+        child = tree_merge(RIGHT(a), b);
+        SET(PP(a), child);
+        return a;
+    }
+    child = tree_merge(a, LEFT(b));
+    SET(SP(b), child);
+    return b;
+}
+
+/* tree_best_fit - the smallest block in the treap that can hold adjsize bytes, NULL if none. */
+static void *tree_best_fit(void *root, size_t adjsize)
+{
+    void *fit = NULL;
+    while (root != NULL)
+    {
+        if (GET_SIZE(HDRP(root)) >= adjsize)
+        {
+            fit = root; // candidate, but a smaller one may be on the left
+            root = LEFT(root);
+        }
+        else root = RIGHT(root);
+    }
+    return fit;
 }
 
-/* seglist_init - initialize the segregated free lists. */
+/* tree_prio - heap priority of a treap node, a hash of its address so nothing has to be stored. */
+static unsigned int tree_prio(void *bp)
+{
+    unsigned int x = (unsigned int)(size_t)bp >> 3;
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+/* find_index - get the proper index of segregated free list according to its size */
+static int find_index(size_t size)
+{
+    // under 256B, seglist is divided into 32B interval
+    if (size < 256) return ((int)size) >> 5;
+
+    // after 256B, seglist interval is powers of 2: [2^(k-1), 2^k) goes to seglist k. 
+    int seg_index = 32 - __builtin_clz((unsigned int)size);
+    return MIN(seg_index, 23);
+}
+
+/* seglist_init - initialize the segregated free lists and the rest of the arena header. */
 static void seglist_init(void)
 {
     void **p;
     int seg_index = 0;
-    while (seg_index < 24)
+    while (seg_index < NLISTS)
     {
         p = find_list(seg_index);
         *p = NULL;
         seg_index++;
     }
+    for (seg_index = 0; seg_index < 8; seg_index++) *find_slab(seg_index) = NULL;
+    AR_REMOTE(arena) = NULL;
+    AR_QTOTAL(arena) = 0;
+    for (seg_index = 0; seg_index < NQUICK; seg_index++)
+    {
+        AR_QUICK(arena, seg_index) = NULL;
+        AR_QSIZE(arena, seg_index) = 0;
+        AR_QCOUNT(arena, seg_index) = 0;
+    }
+    for (seg_index = 0; seg_index < NBUDDY; seg_index++) AR_BUDDY(arena, seg_index) = NULL;
+    AR_ROVER(arena) = NULL;
+    AR_LIFE(arena) = NULL;
+    AR_WILD(arena) = NULL;
+    AR_HEAP(arena) = 0;
+    AR_TICK(arena) = 0;
+    AR_SITE(arena) = 0;
+    AR_BITMAP(arena) = 0;
+    AR_SMALL_LIVE(arena) = 0;
+    AR_SLAB_ON(arena) = 0;
+    AR_INDEX(arena) = 0;
+}
+
+/* find_slab - find the run list of the i-th slot class (slot size ALIGNMENT*(i+1)) */
+static void **find_slab(int i)
+{
+    return &AR_SLAB(arena, i);
 }
 
 /* find_list - find the corresponding seglist from find_index */
 static void **find_list(int i)
 {
-    void** p;
-    switch (i) {
-    case 0:
-        p = &seglist0;
-        break;
-    case 1:
-        p = &seglist1;
-        break;
-    case 2:
-        p = &seglist2;
-        break;
-    case 3:
-        p = &seglist3;
-        break;
-    case 4:
-        p = &seglist4;
-        break;
-    case 5:
-        p = &seglist5;
-        break;
-    case 6:
-        p = &seglist6;
-        break;
-    case 7:
-        p = &seglist7;
-        break;
-    case 8:
-        p = &seglist8;
-        break;
-    case 9:
-        p = &seglist9;
-        break;
-    case 10:
-        p = &seglist10;
-        break;
-    case 11:
-        p = &seglist11;
-        break;
-    case 12:
-        p = &seglist12;
-        break;
-    case 13:
-        p = &seglist13;
-        break;
-    case 14:
-        p = &seglist14;
-        break;
-    case 15:
-        p = &seglist15;
-        break;
-    case 16:
-        p = &seglist16;
-        break;
-    case 17:
-        p = &seglist17;
-        break;
-    case 18:
-        p = &seglist18;
-        break;
-    case 19:
-        p = &seglist19;
-        break;
-    case 20:
-        p = &seglist20;
-        break;
-    case 21:
-        p = &seglist21;
-        break;
-    case 22:
-        p = &seglist22;
-        break;
-    case 23:
-        p = &seglist23;
-        break;
-    default:
-        p = NULL;
-    }
-    return p;
+    return &AR_LIST(arena, i);
 }
-
@@ -4,6 +4,19 @@ extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
+extern void *mm_memalign(size_t alignment, size_t size);
+extern void *mm_aligned_alloc(size_t alignment, size_t size);
+extern void *mm_calloc(size_t nmemb, size_t size);
+extern void mm_free_sized(void *ptr, size_t size);
+extern size_t mm_usable_size(void *ptr);
+extern int mm_malloc_batch(size_t size, int n, void **out);
+extern void mm_free_batch(void **ptrs, int n);
+extern void *mm_malloc_site(size_t size, int site);
+extern int mm_lifetime(size_t size, int site);
+
+/* a block freed within this many allocations after its own is short-lived, for mm_lifetime (MM_LIFETIME=1).
+   mm_lifetime returns 1 or 0, or -1 while the predictor has not started yet */
+#define MM_SHORT_LIVED 64
 
 
 /* 
@@ -81,6 +81,11 @@ while ($line = <STDIN>) {
     # save the line for output later
     $lines[$requestnum++] = $line;
 
+    # aligned and zeroed allocate requests are checked like any other allocate
+    if ($cmd eq "m" or $cmd eq "c") {
+	$cmd = "a";
+    }
+
     #ignore realloc requests, as long as they are preceeded by an alloc request
     if ($cmd eq "r") {
 	if (!$HASH{$id}) {
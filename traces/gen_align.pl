@@ -0,0 +1,71 @@
+#!/usr/bin/perl
+#!/usr/local/bin/perl
+
+$out_filename = $argv[0];
+$out_filename = "align.rep" unless $out_filename;
+$num_blocks = $argv[1];
+$num_blocks = 2400 unless $num_blocks;
+$max_blk_size = $argv[2];
+$max_blk_size = 4096 unless $max_blk_size;
+
+# Alignments of the aligned allocate requests; about half of the
+# requests ask for one of them, the rest are plain mallocs
+@aligns = (32, 64, 128, 4096);
+
+#print "Output file: $out_filename\n";
+#print "Number of blocks: $num_blocks\n";
+#print "Max block size: $max_blk_size\n";
+
+# Create trace
+# Make a series of malloc()s and memalign()s
+for ($i = 0;  $i < $num_blocks; $i += 1) {
+    $size = int(rand $max_blk_size) + 1;
+    $op = {};
+    $op->{seq} = $i;
+    $op->{size} = $size;
+    if (rand() < 0.5) {
+        $op->{type} = "m";
+        $op->{align} = $aligns[int(rand @aligns)];
+    } else {
+        $op->{type} = "a";
+    }
+    $total_block_size += $size;
+    push @trace, $op;
+}
+# Insert free()s in proper places
+for ($i = 0;  $i < $num_blocks; $i += 1) {
+    for ($minval = $i; $minval < $num_blocks + $i; $minval += 1) {
+        if (($trace[$minval]->{type} ne "f") && ($trace[$minval]->{seq} == $i)) {
+            last;
+        }
+    }
+    $pos = int(rand($num_blocks + $i - $minval - 1) + $minval + 1);
+    $op = {};
+    $op->{type} = "f";
+    $op->{seq} = $i;
+    splice @trace, $pos, 0, $op;
+}
+
+# Open output file
+open OUTFILE, ">$out_filename" or die "Cannot create $out_filename\n";
+
+# Calculate misc parameters
+$suggested_heap_size = $total_block_size + 100;
+$num_ops = 2*$num_blocks;
+
+print OUTFILE "$suggested_heap_size\n";
+print OUTFILE "$num_blocks\n";
+print OUTFILE "$num_ops\n";
+print OUTFILE "1\n";
+
+for ($i = 0;  $i < 2*$num_blocks; $i += 1) {
+    if ($trace[$i]->{type} eq "a") {
+        print OUTFILE "$trace[$i]->{type} $trace[$i]->{seq} $trace[$i]->{size}\n";
+    } elsif ($trace[$i]->{type} eq "m") {
+        print OUTFILE "$trace[$i]->{type} $trace[$i]->{seq} $trace[$i]->{size} $trace[$i]->{align}\n";
+    } else {
+        print OUTFILE "$trace[$i]->{type} $trace[$i]->{seq}\n";
+    }
+}
+
+close OUTFILE;
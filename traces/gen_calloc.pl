@@ -0,0 +1,71 @@
+#!/usr/bin/perl
+#!/usr/local/bin/perl
+
+$out_filename = $argv[0];
+$out_filename = "calloc.rep" unless $out_filename;
+$num_blocks = $argv[1];
+$num_blocks = 2400 unless $num_blocks;
+$max_blk_size = $argv[2];
+$max_blk_size = 2048 unless $max_blk_size;
+
+#print "Output file: $out_filename\n";
+#print "Number of blocks: $num_blocks\n";
+#print "Max block size: $max_blk_size\n";
+
+# Create trace
+# Make a series of malloc()s and calloc()s. About one in ten calloc()s
+# is a hash table of 512 to 256K buckets of 8 bytes; the others are
+# small records, like the malloc()s that dirty the heap around them
+for ($i = 0;  $i < $num_blocks; $i += 1) {
+    $op = {};
+    $op->{seq} = $i;
+    if (rand() < 0.4) {
+        $op->{type} = "c";
+        if (rand() < 0.1) {
+            $size = 8 << (9 + int(rand 10));
+        } else {
+            $size = int(rand $max_blk_size) + 1;
+        }
+    } else {
+        $op->{type} = "a";
+        $size = int(rand $max_blk_size) + 1;
+    }
+    $op->{size} = $size;
+    $total_block_size += $size;
+    push @trace, $op;
+}
+# Insert free()s in proper places
+for ($i = 0;  $i < $num_blocks; $i += 1) {
+    for ($minval = $i; $minval < $num_blocks + $i; $minval += 1) {
+        if (($trace[$minval]->{type} ne "f") && ($trace[$minval]->{seq} == $i)) {
+            last;
+        }
+    }
+    $pos = int(rand($num_blocks + $i - $minval - 1) + $minval + 1);
+    $op = {};
+    $op->{type} = "f";
+    $op->{seq} = $i;
+    splice @trace, $pos, 0, $op;
+}
+
+# Open output file
+open OUTFILE, ">$out_filename" or die "Cannot create $out_filename\n";
+
+# Calculate misc parameters
+$suggested_heap_size = $total_block_size + 100;
+$num_ops = 2*$num_blocks;
+
+print OUTFILE "$suggested_heap_size\n";
+print OUTFILE "$num_blocks\n";
+print OUTFILE "$num_ops\n";
+print OUTFILE "1\n";
+
+for ($i = 0;  $i < 2*$num_blocks; $i += 1) {
+    if ($trace[$i]->{type} ne "f") {
+        print OUTFILE "$trace[$i]->{type} $trace[$i]->{seq} $trace[$i]->{size}\n";
+    } else {
+        print OUTFILE "$trace[$i]->{type} $trace[$i]->{seq}\n";
+    }
+}
+
+close OUTFILE;
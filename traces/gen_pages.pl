@@ -0,0 +1,68 @@
+#!/usr/bin/perl
+#!/usr/local/bin/perl
+
+$out_filename = $argv[0];
+$out_filename = "pages.rep" unless $out_filename;
+$num_blocks = $argv[1];
+$num_blocks = 1200 unless $num_blocks;
+$max_pages = $argv[2];
+$max_pages = 32 unless $max_pages;
+
+#print "Output file: $out_filename\n";
+#print "Number of blocks: $num_blocks\n";
+#print "Max pages: $max_pages\n";
+
+# Create trace
+# Make a series of page-granular malloc()s: most are a power of two
+# pages, some a few whole pages, and some a buffer just under a page
+for ($i = 0;  $i < $num_blocks; $i += 1) {
+    $r = rand();
+    if ($r < 0.6) {
+        $size = 4096 << int(rand(log($max_pages) / log(2) + 1));
+    } elsif ($r < 0.85) {
+        $size = 4096 * (int(rand $max_pages) + 1);
+    } else {
+        $size = 4096 - int(rand 128);
+    }
+    $op = {};
+    $op->{type} = "a";
+    $op->{seq} = $i;
+    $op->{size} = $size;
+    $total_block_size += $size;
+    push @trace, $op;
+}
+# Insert free()s in proper places
+for ($i = 0;  $i < $num_blocks; $i += 1) {
+    for ($minval = $i; $minval < $num_blocks + $i; $minval += 1) {
+        if (($trace[$minval]->{type} ne "f") && ($trace[$minval]->{seq} == $i)) {
+            last;
+        }
+    }
+    $pos = int(rand($num_blocks + $i - $minval - 1) + $minval + 1);
+    $op = {};
+    $op->{type} = "f";
+    $op->{seq} = $i;
+    splice @trace, $pos, 0, $op;
+}
+
+# Open output file
+open OUTFILE, ">$out_filename" or die "Cannot create $out_filename\n";
+
+# Calculate misc parameters
+$suggested_heap_size = $total_block_size + 100;
+$num_ops = 2*$num_blocks;
+
+print OUTFILE "$suggested_heap_size\n";
+print OUTFILE "$num_blocks\n";
+print OUTFILE "$num_ops\n";
+print OUTFILE "1\n";
+
+for ($i = 0;  $i < 2*$num_blocks; $i += 1) {
+    if ($trace[$i]->{type} eq "a") {
+        print OUTFILE "$trace[$i]->{type} $trace[$i]->{seq} $trace[$i]->{size}\n";
+    } else {
+        print OUTFILE "$trace[$i]->{type} $trace[$i]->{seq}\n";
+    }
+}
+
+close OUTFILE;